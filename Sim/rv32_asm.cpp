@@ -1,458 +1,1069 @@
 // rv32_asm_V5.cpp
 // Features: Zero-copy parsing, Data-driven ISA, Two-pass resolution.
-// Supported: R, I, S, B, U, J types + Pseudo-instructions (nop, mv).
-// g++ -std=c++17 rv32_asm.cpp -o assembler : in termial 
+// Supported: R, I, S, B, U, J types + the standard pseudo-instructions (li, la, call, ret, beqz, ...).
+// The engine lives in rv32_asm.hpp; this file is the command-line driver.
+// g++ -std=c++17 -pthread rv32_asm.cpp -o assembler : in termial 
 // .\assembler.exe test.s
 
-#include <iostream>
-#include <fstream>
-#include <vector>
-#include <string>
-#include <string_view>
-#include <unordered_map>
-#include <optional>
-#include <variant>
-#include <iomanip>
-#include <algorithm>
-#include <stdexcept>
-#include <cctype>
-#include <cstdint>
-
-namespace rv32 {
-
-using Address = uint32_t;
-using InstructionCode = uint32_t;
-
-enum class InstrType { R_TYPE, I_TYPE, S_TYPE, B_TYPE, U_TYPE, J_TYPE, PSEUDO };
-
-struct InstructionDef {
-    InstrType type;
-    uint32_t opcode;
-    uint32_t funct3;
-    uint32_t funct7;
-};
+#include "rv32_asm.hpp"
 
-struct Token {
-    enum Kind { Label, Mnemonic, Register, Immediate, Comma, LParen, RParen, Directive, EndOfLine };
-    Kind kind;
-    std::string_view text; // points into original source string
-    size_t lineNum;
-};
+#include <chrono>
+#include <filesystem>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <atomic>
 
-// ============================================================================
-// 1. ISA DATABASE
-// ============================================================================
-class ISA {
-public:
-    static std::optional<InstructionDef> getDef(std::string_view mnemonic_sv) {
-        static const std::unordered_map<std::string, InstructionDef> table = {
-            // R-Type
-            {"add",  {InstrType::R_TYPE, 0x33, 0x0, 0x00}},
-            {"sub",  {InstrType::R_TYPE, 0x33, 0x0, 0x20}},
-            {"xor",  {InstrType::R_TYPE, 0x33, 0x4, 0x00}},
-            {"or",   {InstrType::R_TYPE, 0x33, 0x6, 0x00}},
-            {"and",  {InstrType::R_TYPE, 0x33, 0x7, 0x00}},
-            {"sll",  {InstrType::R_TYPE, 0x33, 0x1, 0x00}},
-            {"srl",  {InstrType::R_TYPE, 0x33, 0x5, 0x00}},
-            {"sra",  {InstrType::R_TYPE, 0x33, 0x5, 0x20}},
-            {"slt",  {InstrType::R_TYPE, 0x33, 0x2, 0x00}},
-            {"sltu", {InstrType::R_TYPE, 0x33, 0x3, 0x00}},
-
-            // I-Type
-            {"addi", {InstrType::I_TYPE, 0x13, 0x0, 0x00}},
-            {"xori", {InstrType::I_TYPE, 0x13, 0x4, 0x00}},
-            {"ori",  {InstrType::I_TYPE, 0x13, 0x6, 0x00}},
-            {"andi", {InstrType::I_TYPE, 0x13, 0x7, 0x00}},
-            {"slli", {InstrType::I_TYPE, 0x13, 0x1, 0x00}},
-            {"srli", {InstrType::I_TYPE, 0x13, 0x5, 0x00}},
-            {"srai", {InstrType::I_TYPE, 0x13, 0x5, 0x20}},
-            {"slti", {InstrType::I_TYPE, 0x13, 0x2, 0x00}},
-            {"sltiu",{InstrType::I_TYPE, 0x13, 0x3, 0x00}},
-            {"lb",   {InstrType::I_TYPE, 0x03, 0x0, 0x00}},
-            {"lh",   {InstrType::I_TYPE, 0x03, 0x1, 0x00}},
-            {"lw",   {InstrType::I_TYPE, 0x03, 0x2, 0x00}},
-            {"lbu",  {InstrType::I_TYPE, 0x03, 0x4, 0x00}},
-            {"lhu",  {InstrType::I_TYPE, 0x03, 0x5, 0x00}},
-            {"jalr", {InstrType::I_TYPE, 0x67, 0x0, 0x00}},
-
-            // S-Type
-            {"sb",   {InstrType::S_TYPE, 0x23, 0x0, 0x00}},
-            {"sh",   {InstrType::S_TYPE, 0x23, 0x1, 0x00}},
-            {"sw",   {InstrType::S_TYPE, 0x23, 0x2, 0x00}},
-
-            // B-Type
-            {"beq",  {InstrType::B_TYPE, 0x63, 0x0, 0x00}},
-            {"bne",  {InstrType::B_TYPE, 0x63, 0x1, 0x00}},
-            {"blt",  {InstrType::B_TYPE, 0x63, 0x4, 0x00}},
-            {"bge",  {InstrType::B_TYPE, 0x63, 0x5, 0x00}},
-            {"bltu", {InstrType::B_TYPE, 0x63, 0x6, 0x00}},
-            {"bgeu", {InstrType::B_TYPE, 0x63, 0x7, 0x00}},
-
-            // U-Type
-            {"lui",  {InstrType::U_TYPE, 0x37, 0x0, 0x00}},
-            {"auipc",{InstrType::U_TYPE, 0x17, 0x0, 0x00}},
-
-            // J-Type
-            {"jal",  {InstrType::J_TYPE, 0x6F, 0x0, 0x00}},
-
-            // Pseudo-Instructions
-            {"nop",  {InstrType::PSEUDO, 0x13, 0x0, 0x00}}, // addi x0, x0, 0
-            {"mv",   {InstrType::PSEUDO, 0x13, 0x0, 0x00}}, // addi rd, rs, 0
-            {"not",  {InstrType::PSEUDO, 0x13, 0x4, 0x00}}, // xori rd, rs, -1
-        };
+#if defined(__unix__) || defined(__APPLE__)
+#define RV32_HAVE_MMAP 1
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define RV32_HAVE_UNIX_SOCKETS 1
+#include <sys/socket.h>
+#include <sys/un.h>
+#define RV32_HAVE_RUSAGE 1
+#include <sys/resource.h>
+#else
+#define RV32_HAVE_MMAP 0
+#define RV32_HAVE_UNIX_SOCKETS 0
+#define RV32_HAVE_RUSAGE 0
+#endif
 
-        std::string key(mnemonic_sv);
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-        auto it = table.find(key);
-        if (it != table.end()) return it->second;
-        return std::nullopt;
-    }
-
-    static std::optional<uint8_t> getRegister(std::string_view reg_sv) {
-        static const std::unordered_map<std::string, uint8_t> regs = {
-            {"x0", 0}, {"zero", 0}, {"x1", 1}, {"ra", 1}, {"x2", 2}, {"sp", 2},
-            {"x3", 3}, {"gp", 3},   {"x4", 4}, {"tp", 4}, {"x5", 5}, {"t0", 5},
-            {"x6", 6}, {"t1", 6},   {"x7", 7}, {"t2", 7}, {"x8", 8}, {"s0", 8}, {"fp", 8},
-            {"x9", 9}, {"s1", 9}, {"x10", 10}, {"a0", 10}, {"x11", 11}, {"a1", 11},
-            {"x12", 12}, {"a2", 12}, {"x13", 13}, {"a3", 13}, {"x14", 14}, {"a4", 14},
-            {"x15", 15}, {"a5", 15}, {"x16", 16}, {"a6", 16}, {"x17", 17}, {"a7", 17},
-            {"x18", 18}, {"s2", 18}, {"x19", 19}, {"s3", 19}, {"x20", 20}, {"s4", 20},
-            {"x21", 21}, {"s5", 21}, {"x22", 22}, {"s6", 22}, {"x23", 23}, {"s7", 23},
-            {"x24", 24}, {"s8", 24}, {"x25", 25}, {"s9", 25}, {"x26", 26}, {"s10", 26},
-            {"x27", 27}, {"s11", 27}, {"x28", 28}, {"t3", 28}, {"x29", 29}, {"t4", 29},
-            {"x30", 30}, {"t5", 30}, {"x31", 31}, {"t6", 31}
-        };
+#if defined(__linux__)
+#define RV32_HAVE_INOTIFY 1
+#include <sys/inotify.h>
+#else
+#define RV32_HAVE_INOTIFY 0
+#endif
+
+// ---------------- DRIVER ----------------
+std::string readFile(const char* filename) {
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if (!in) throw std::runtime_error("Could not open file");
+    std::string contents;
+    in.seekg(0, std::ios::end);
+    std::streampos len = in.tellg();
+    if (len > 0) {
+        contents.resize(static_cast<size_t>(len));
+        in.seekg(0, std::ios::beg);
+        in.read(&contents[0], contents.size());
+    } else {
+        in.clear(); in.seekg(0);
+        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    return contents;
+}
+
+// Read-only view of an assembler input. Regular files are memory-mapped, so
+// the Lexer reads straight from the page cache with no copy; pipes, devices
+// and "-" (stdin) fall back to reading into a buffer. The view is exactly the
+// file's bytes: the lexer is bounds-checked and needs no trailing newline.
+class SourceFile {
+    std::string owned;
+    const char* mapped = nullptr;
+    size_t mappedLen = 0;
+
+#if RV32_HAVE_MMAP
+    void readAll(int fd) {
+        char buf[1 << 16];
+        for (;;) {
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if (n < 0) throw std::runtime_error("Could not read input");
+            if (n == 0) break;
+            owned.append(buf, static_cast<size_t>(n));
+        }
+    }
+#endif
+
+public:
+    explicit SourceFile(const char* filename) {
+#if RV32_HAVE_MMAP
+        if (std::string_view(filename) == "-") { readAll(STDIN_FILENO); return; }
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Could not open file " + std::string(filename));
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                ::madvise(p, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+                mapped = static_cast<const char*>(p);
+                mappedLen = static_cast<size_t>(st.st_size);
+            }
+        }
+        if (!mapped) {
+            try { readAll(fd); } catch (...) { ::close(fd); throw; }
+        }
+        ::close(fd);
+#else
+        owned = readFile(filename);
+#endif
+    }
 
-        std::string key(reg_sv);
-        std::transform(key.begin(), key.end(), key.begin(), ::tolower);
-        auto it = regs.find(key);
-        if (it != regs.end()) return it->second;
-        return std::nullopt;
+    ~SourceFile() {
+#if RV32_HAVE_MMAP
+        if (mapped) ::munmap(const_cast<char*>(mapped), mappedLen);
+#endif
     }
+
+    SourceFile(const SourceFile&) = delete;
+    SourceFile& operator=(const SourceFile&) = delete;
+
+    std::string_view view() const { return mapped ? std::string_view(mapped, mappedLen) : std::string_view(owned); }
+    bool isMapped() const { return mapped != nullptr; }
 };
 
-// ============================================================================
-// 2. LEXER
-// ============================================================================
-class Lexer {
-    std::string_view src;
-    size_t cursor = 0;
-    size_t line = 1;
+// XXH64 of `data`. Fast enough (several GB/s) that hashing an unchanged file
+// costs a small fraction of assembling it; the cache keys on it.
+inline uint64_t xxh64(const void* data, size_t len, uint64_t seed) {
+    constexpr uint64_t P1 = 0x9E3779B185EBCA87ull, P2 = 0xC2B2AE3D27D4EB4Full, P3 = 0x165667B19E3779F9ull,
+                       P4 = 0x85EBCA77C2B2AE63ull, P5 = 0x27D4EB2F165667C5ull;
+    auto rotl = [](uint64_t x, int r) { return (x << r) | (x >> (64 - r)); };
+    auto read64 = [](const unsigned char* p) { uint64_t v; std::memcpy(&v, p, 8); return v; };
+    auto read32 = [](const unsigned char* p) { uint32_t v; std::memcpy(&v, p, 4); return v; };
+    auto round = [&](uint64_t acc, uint64_t in) { return rotl(acc + in * P2, 31) * P1; };
+    auto merge = [&](uint64_t h, uint64_t v) { return (h ^ round(0, v)) * P1 + P4; };
 
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* const end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+    } else {
+        h = seed + P5;
+    }
+    h += len;
+    for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+    if (p + 4 <= end) { h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3; p += 4; }
+    for (; p < end; ++p) h = rotl(h ^ (*p * P5), 11) * P1;
+    h ^= h >> 33; h *= P2;
+    h ^= h >> 29; h *= P3;
+    return h ^ (h >> 32);
+}
+
+#if RV32_HAVE_MMAP
+// --cache: content-addressed store of assembled images on disk. An entry is
+// keyed by the hash of the source bytes, seeded with the ISA fingerprint and
+// encoder revision, so an assembler change never serves a stale image. It
+// holds the placed segments (not a rendered format), so one entry serves
+// every --format. Layout, host byte order:
+//   header:   magic, version, key (2 x u32), source length (2 x u32), segment count, word count
+//   segments: base, word count           (one pair per segment)
+//   words:    every segment's words, in segment order
+// A hit maps the file and points ImageSegments straight into it.
+//
+// Entries are written to a private temp file and renamed into place, so
+// concurrent writers (batch workers, parallel nightly jobs) never expose a
+// partial entry. A hit refreshes the file's mtime; when the directory grows
+// past its budget the least recently used entries go until it is back under
+// three quarters of it.
+class ImageCache {
 public:
-    Lexer(std::string_view source) : src(source) {}
+    struct Stats {
+        std::atomic<size_t> hits{0}, misses{0}, stores{0}, evictions{0};
+    };
 
-    std::vector<Token> tokenize() {
-        std::vector<Token> tokens;
-        while (cursor < src.size()) {
-            char c = src[cursor];
+    // A mapped entry. Reusable: lookup() releases the previous mapping.
+    class Entry {
+        friend class ImageCache;
+        void* map = nullptr;
+        size_t mapLen = 0;
+        std::vector<rv32::ImageSegment> segs;
 
-            if (c == '#') { // Comment
-                while (cursor < src.size() && src[cursor] != '\n') ++cursor;
-                continue;
-            }
-            if (std::isspace(static_cast<unsigned char>(c))) {
-                if (c == '\n') ++line;
-                ++cursor;
-                continue;
-            }
-            if (c == ',') { tokens.push_back({Token::Comma, ",", line}); ++cursor; continue; }
-            if (c == '(') { tokens.push_back({Token::LParen, "(", line}); ++cursor; continue; }
-            if (c == ')') { tokens.push_back({Token::RParen, ")", line}); ++cursor; continue; }
-
-            if (c == '.') { // Directive
-                size_t start = cursor++;
-                while (cursor < src.size() && (std::isalnum(static_cast<unsigned char>(src[cursor])) || src[cursor]=='_')) ++cursor;
-                tokens.push_back({Token::Directive, src.substr(start, cursor - start), line});
-                continue;
-            }
+        void release() {
+            if (map) ::munmap(map, mapLen);
+            map = nullptr;
+            segs.clear();
+        }
 
-            if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') { // Words
-                size_t start = cursor;
-                while (cursor < src.size() && (std::isalnum(static_cast<unsigned char>(src[cursor])) || src[cursor] == '_')) ++cursor;
-                if (cursor < src.size() && src[cursor] == ':') { // Label
-                    tokens.push_back({Token::Label, src.substr(start, cursor - start), line});
-                    ++cursor; 
-                    continue;
-                }
-                std::string_view word = src.substr(start, cursor - start);
-                if (ISA::getRegister(word)) tokens.push_back({Token::Register, word, line});
-                else tokens.push_back({Token::Mnemonic, word, line});
-                continue;
+    public:
+        Entry() = default;
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+        ~Entry() { release(); }
+
+        const std::vector<rv32::ImageSegment>& image() const { return segs; }
+    };
+
+    ImageCache(std::string directory, uint64_t maxBytes) : dir(std::move(directory)), budget(maxBytes) {
+        namespace fs = std::filesystem;
+        fs::create_directories(dir);
+        uint64_t total = 0;
+        for (const auto& e : fs::directory_iterator(dir))
+            if (e.is_regular_file() && e.path().extension() == ".img") total += e.file_size();
+        bytes = total;
+    }
+
+    static uint64_t key(std::string_view source) {
+        return xxh64(source.data(), source.size(), (uint64_t(rv32::ISA::fingerprint()) << 32) | rv32::kEncoderRevision);
+    }
+
+    // True, with `entry` mapping the image, if `source` has been assembled before.
+    bool lookup(std::string_view source, Entry& entry) {
+        entry.release();
+        const uint64_t k = key(source);
+        const int fd = ::open(pathOf(k).c_str(), O_RDONLY);
+        if (fd < 0) { ++counters.misses; return false; }
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(Header))) {
+            void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                entry.map = p;
+                entry.mapLen = static_cast<size_t>(st.st_size);
             }
+        }
+        if (entry.map && parse(entry, k, source.size())) {
+            ::futimens(fd, nullptr); // most recently used
+            ::close(fd);
+            ++counters.hits;
+            return true;
+        }
+        ::close(fd);
+        entry.release();
+        ++counters.misses;
+        return false;
+    }
+
+    // Records the image of a successful run of `as` on `source`.
+    void store(std::string_view source, const rv32::Assembler& as) {
+        const uint64_t k = key(source);
+        Header h{kMagic, kVersion, {uint32_t(k), uint32_t(k >> 32)},
+                 {uint32_t(source.size()), uint32_t(uint64_t(source.size()) >> 32)}, 0, 0};
+        as.forEachSegment([&](const rv32::ImageSegment& seg) { ++h.segments; h.words += static_cast<uint32_t>(seg.count); });
+
+        std::string blob;
+        blob.reserve(sizeof(Header) + 8 * size_t(h.segments) + 4 * size_t(h.words));
+        auto put = [&](const void* p, size_t n) { blob.append(static_cast<const char*>(p), n); };
+        put(&h, sizeof(h));
+        as.forEachSegment([&](const rv32::ImageSegment& seg) {
+            const uint32_t pair[2] = {seg.base, static_cast<uint32_t>(seg.count)};
+            put(pair, sizeof(pair));
+        });
+        as.forEachSegment([&](const rv32::ImageSegment& seg) { put(seg.words, seg.count * 4); });
+
+        const std::string final = pathOf(k);
+        const std::string temp = final + "." + std::to_string(::getpid()) + "-" + std::to_string(++tempSerial) + ".tmp";
+        const int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) return; // the cache is best-effort: never fail a build over it
+        bool ok = true;
+        for (size_t off = 0; ok && off < blob.size();) {
+            const ssize_t n = ::write(fd, blob.data() + off, blob.size() - off);
+            if (n > 0) off += static_cast<size_t>(n);
+            else ok = n < 0 && errno == EINTR;
+        }
+        // Another process or worker may have stored this key already; the
+        // rename replaces its entry, whose size must leave the total.
+        struct stat old;
+        const uint64_t replaced = ::stat(final.c_str(), &old) == 0 ? static_cast<uint64_t>(old.st_size) : 0;
+        ok = (::close(fd) == 0) && ok && ::rename(temp.c_str(), final.c_str()) == 0;
+        if (!ok) { ::unlink(temp.c_str()); return; }
+        ++counters.stores;
+        bytes -= std::min<uint64_t>(replaced, bytes);
+        if ((bytes += blob.size()) > budget) evict();
+    }
+
+    const Stats& stats() const { return counters; }
+
+private:
+    struct Header {
+        uint32_t magic, version;
+        uint32_t key[2], sourceLen[2];
+        uint32_t segments, words;
+    };
+    static constexpr uint32_t kMagic = 0x49563352; // "R3VI"
+    static constexpr uint32_t kVersion = 1;        // of the file layout
+
+    std::string dir;
+    uint64_t budget;
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint32_t> tempSerial{0};
+    std::mutex evictLock;
+    Stats counters;
+
+    std::string pathOf(uint64_t k) const {
+        std::string name = dir + "/0000000000000000.img";
+        for (size_t i = 0; i < 16; ++i) name[dir.size() + 1 + i] = "0123456789abcdef"[(k >> (60 - 4 * i)) & 0xF];
+        return name;
+    }
+
+    // Checks the header against the expected key and the sizes against the
+    // file, then points entry.segs into the mapping. Anything off is a miss.
+    static bool parse(Entry& entry, uint64_t k, size_t sourceLen) {
+        const char* base = static_cast<const char*>(entry.map);
+        Header h;
+        std::memcpy(&h, base, sizeof(h));
+        if (h.magic != kMagic || h.version != kVersion || h.key[0] != uint32_t(k) || h.key[1] != uint32_t(k >> 32) ||
+            h.sourceLen[0] != uint32_t(sourceLen) || h.sourceLen[1] != uint32_t(uint64_t(sourceLen) >> 32) ||
+            entry.mapLen != sizeof(Header) + 8 * uint64_t(h.segments) + 4 * uint64_t(h.words))
+            return false;
+        const uint32_t* table = reinterpret_cast<const uint32_t*>(base + sizeof(Header));
+        const uint32_t* words = table + 2 * size_t(h.segments);
+        uint64_t seen = 0;
+        for (uint32_t i = 0; i < h.segments; ++i) {
+            if ((seen += table[2 * i + 1]) > h.words) return false;
+            entry.segs.push_back({table[2 * i], words, table[2 * i + 1]});
+            words += table[2 * i + 1];
+        }
+        return seen == h.words;
+    }
 
-            if (c == '+' || c == '-' || std::isdigit(static_cast<unsigned char>(c))) { // Immediate
-                size_t start = cursor;
-                if (src[cursor] == '+' || src[cursor] == '-') ++cursor;
-                if (cursor + 1 < src.size() && src[cursor] == '0' && (src[cursor+1] == 'x' || src[cursor+1] == 'X')) {
-                    cursor += 2;
-                    while (cursor < src.size() && std::isxdigit(static_cast<unsigned char>(src[cursor]))) ++cursor;
-                } else {
-                    while (cursor < src.size() && std::isdigit(static_cast<unsigned char>(src[cursor]))) ++cursor;
-                }
-                tokens.push_back({Token::Immediate, src.substr(start, cursor - start), line});
-                continue;
+    // Deletes least recently used entries until the directory is under 3/4
+    // of the budget. Other processes share the directory, so the running
+    // total is re-synchronized from the scan.
+    void evict() {
+        namespace fs = std::filesystem;
+        std::lock_guard<std::mutex> g(evictLock);
+        if (bytes <= budget) return;
+        struct File {
+            fs::file_time_type used;
+            uint64_t size;
+            fs::path path;
+        };
+        std::vector<File> files;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (const auto& e : fs::directory_iterator(dir, ec)) {
+            if (!e.is_regular_file(ec) || e.path().extension() != ".img") continue;
+            File f{e.last_write_time(ec), e.file_size(ec), e.path()};
+            if (ec) continue;
+            total += f.size;
+            files.push_back(std::move(f));
+        }
+        std::sort(files.begin(), files.end(), [](const File& a, const File& b) { return a.used < b.used; });
+        for (const File& f : files) {
+            if (total <= budget / 4 * 3) break;
+            if (fs::remove(f.path, ec)) {
+                total -= f.size;
+                ++counters.evictions;
             }
-            throw std::runtime_error("Unexpected character '" + std::string(1, c) + "' at line " + std::to_string(line));
         }
-        return tokens;
+        bytes = total;
     }
 };
+#else
+class ImageCache;
+#endif
 
-// ============================================================================
-// 3. ASSEMBLER ENGINE
-// ============================================================================
-class Assembler {
-    std::vector<Token> tokens;
-    std::unordered_map<std::string, Address> symbolTable; 
-    std::vector<InstructionCode> binaryOutput;
-    Address currentPC = 0;
+#if RV32_HAVE_UNIX_SOCKETS
+// --serve: a persistent assembler on a Unix domain socket, so test
+// generators skip process start-up and temp files. All integers are u32
+// little-endian:
+//   request: length, then `length` bytes of assembly source
+//   reply:   length, then `length` bytes of payload, which is a status and
+//     0 (ok):     segment count, then per segment: base, word count, words
+//     1 (errors): diagnostic count, then per diagnostic: line, message
+//                 length, message bytes (line 0 for lexical errors)
+// A connection carries any number of request/reply pairs. Each connection
+// is served by its own thread with its own Assembler and buffers, which stay
+// warm across requests.
+class AsmServer {
+    int listener = -1;
+    std::string path;
+    bool bound = false; // the socket file at `path` is ours to remove
 
-    static uint32_t pack(uint32_t val, int offset, int bits) {
-        if (bits == 32) return (val << offset);
-        uint32_t mask = (bits >= 32) ? 0xFFFFFFFFu : ((1u << bits) - 1u);
-        return (val & mask) << offset;
+    static bool readFull(int fd, char* p, size_t n) {
+        while (n) {
+            ssize_t got = ::read(fd, p, n);
+            if (got <= 0) return false;
+            p += got;
+            n -= static_cast<size_t>(got);
+        }
+        return true;
     }
-
-    static int32_t parseImmediate(std::string_view sv) {
-        std::string s(sv);
-        size_t idx = 0;
-        long long val = std::stoll(s, &idx, 0);
-        return static_cast<int32_t>(val);
+    static bool writeFull(int fd, const char* p, size_t n) {
+        while (n) {
+            ssize_t put = ::send(fd, p, n, MSG_NOSIGNAL);
+            if (put <= 0) return false;
+            p += put;
+            n -= static_cast<size_t>(put);
+        }
+        return true;
+    }
+    static void putU32(std::string& out, uint32_t v) {
+        const char b[4] = {char(v), char(v >> 8), char(v >> 16), char(v >> 24)};
+        out.append(b, 4);
     }
+    static uint32_t getU32(const char* b) {
+        return uint32_t(uint8_t(b[0])) | uint32_t(uint8_t(b[1])) << 8 | uint32_t(uint8_t(b[2])) << 16 | uint32_t(uint8_t(b[3])) << 24;
+    }
+
+    static constexpr uint32_t kMaxRequest = 256u << 20;
 
 public:
-    Assembler(std::vector<Token> t) : tokens(std::move(t)) {}
-
-    // --- PASS 1: SYMBOL RESOLUTION ---
-    void pass1() {
-        currentPC = 0;
-        for (size_t i = 0; i < tokens.size(); ++i) {
-            const auto& tk = tokens[i];
-            if (tk.kind == Token::Label) {
-                std::string name(tk.text);
-                if (symbolTable.count(name)) throw std::runtime_error("Duplicate label: " + name);
-                symbolTable.emplace(std::move(name), currentPC);
-            } else if (tk.kind == Token::Mnemonic) {
-                currentPC += 4;
-                // Skip operands
-                while (i + 1 < tokens.size() && tokens[i+1].kind != Token::Mnemonic &&
-                       tokens[i+1].kind != Token::Label && tokens[i+1].kind != Token::Directive) { ++i; }
-            } else if (tk.kind == Token::Directive && tk.text == ".org") {
-                if (i + 1 < tokens.size() && tokens[i+1].kind == Token::Immediate) {
-                    currentPC = static_cast<Address>(parseImmediate(tokens[i+1].text));
-                    ++i;
-                }
+    // Fills `out` (length prefix included) with the reply for the last run.
+    static void encodeReply(const rv32::Assembler& asmCore, std::string& out) {
+        out.assign(4, '\0');
+        if (asmCore.diagnostics().empty()) {
+            const auto image = asmCore.image();
+            putU32(out, 0);
+            putU32(out, static_cast<uint32_t>(image.size()));
+            for (const auto& seg : image) {
+                putU32(out, seg.base);
+                putU32(out, static_cast<uint32_t>(seg.count));
+                for (size_t i = 0; i < seg.count; ++i) putU32(out, seg.words[i]);
+            }
+        } else {
+            putU32(out, 1);
+            putU32(out, static_cast<uint32_t>(asmCore.diagnostics().size()));
+            for (const rv32::Diagnostic& d : asmCore.diagnostics()) {
+                putU32(out, static_cast<uint32_t>(d.line));
+                putU32(out, static_cast<uint32_t>(d.message.size()));
+                out += d.message;
             }
         }
+        const uint32_t len = static_cast<uint32_t>(out.size() - 4);
+        for (int i = 0; i < 4; ++i) out[i] = char(len >> (8 * i));
     }
 
-    // --- PASS 2: BINARY GENERATION ---
-    void pass2() {
-        currentPC = 0;
-        binaryOutput.clear();
+    static void encodeFailure(const std::string& message, std::string& out) {
+        out.assign(4, '\0');
+        putU32(out, 1);
+        putU32(out, 1);
+        putU32(out, 0);
+        putU32(out, static_cast<uint32_t>(message.size()));
+        out += message;
+        const uint32_t len = static_cast<uint32_t>(out.size() - 4);
+        for (int i = 0; i < 4; ++i) out[i] = char(len >> (8 * i));
+    }
 
-        for (size_t i = 0; i < tokens.size(); ++i) {
-            const auto& tk = tokens[i];
-            if (tk.kind == Token::Label) continue;
-            if (tk.kind == Token::Directive) {
-                if (tk.text == ".org") {
-                    if (i + 1 < tokens.size() && tokens[i+1].kind == Token::Immediate) {
-                        currentPC = static_cast<Address>(parseImmediate(tokens[i+1].text));
-                        ++i; 
-                    }
-                }
-                continue;
+    // Answers requests on one connection until the peer closes it.
+    static void serveConnection(int fd) {
+        rv32::Assembler asmCore;
+        std::string source, reply;
+        char header[4];
+        while (readFull(fd, header, 4)) {
+            const uint32_t len = getU32(header);
+            if (len > kMaxRequest) break;
+            source.resize(len);
+            if (!readFull(fd, source.data(), len)) break;
+            try {
+                asmCore.assemble(source);
+                encodeReply(asmCore, reply);
+            } catch (const std::exception& e) {
+                encodeFailure(e.what(), reply);
             }
-            if (tk.kind != Token::Mnemonic) continue;
+            if (!writeFull(fd, reply.data(), reply.size())) break;
+        }
+        ::close(fd);
+    }
 
-            auto defOpt = ISA::getDef(tk.text);
-            if (!defOpt) throw std::runtime_error("Unknown instruction: " + std::string(tk.text));
-            InstructionDef def = *defOpt;
-            uint32_t instr = 0;
+    explicit AsmServer(std::string socketPath) : path(std::move(socketPath)) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("Socket path too long: " + path);
+        std::copy(path.begin(), path.end(), addr.sun_path);
+        // A stale socket from an earlier run is replaced; anything else at
+        // the path (a mistyped source file, say) is left alone.
+        struct stat st;
+        if (::lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) throw std::runtime_error("Not a socket, refusing to replace: " + path);
+            ::unlink(path.c_str());
+        }
+        listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listener < 0) throw std::runtime_error("Could not create socket");
+        bound = ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+        if (!bound || ::listen(listener, 64) != 0) {
+            ::close(listener);
+            if (bound) ::unlink(path.c_str());
+            throw std::runtime_error("Could not listen on " + path);
+        }
+    }
 
-            // Safe token consumer
-            auto next = [&](size_t &idx) -> const Token& {
-                if (++idx >= tokens.size()) throw std::runtime_error("Unexpected end of tokens");
-                return tokens[idx];
-            };
-            size_t idx = i; 
-
-            // --- ENCODING LOGIC ---
-            if (def.type == InstrType::PSEUDO) {
-                // Handling Pseudo-Instructions
-                if (tk.text == "nop" || tk.text == "NOP") {
-                    // nop -> addi x0, x0, 0
-                    instr = 0x00000013; 
-                    i = idx; 
-                }
-                else if (tk.text == "mv" || tk.text == "MV") {
-                    // mv rd, rs -> addi rd, rs, 0
-                    const Token& t1 = next(idx); // rd
-                    uint8_t rd = ISA::getRegister(t1.text).value();
-                    next(idx); // comma
-                    const Token& t3 = next(idx); // rs
-                    uint8_t rs1 = ISA::getRegister(t3.text).value();
-                    
-                    // Encode as ADDI (Op: 0x13, F3: 0, Imm: 0)
-                    instr = pack(0x13, 0, 7) | pack(rd, 7, 5) | pack(0, 12, 3) | pack(rs1, 15, 5) | pack(0, 20, 12);
-                    i = idx;
-                }
-                else if (tk.text == "not" || tk.text == "NOT") {
-                    // not rd, rs -> xori rd, rs, -1
-                    const Token& t1 = next(idx);
-                    uint8_t rd = ISA::getRegister(t1.text).value();
-                    next(idx);
-                    const Token& t3 = next(idx);
-                    uint8_t rs1 = ISA::getRegister(t3.text).value();
-                    
-                    // Encode as XORI (Op: 0x13, F3: 4, Imm: -1)
-                    instr = pack(0x13, 0, 7) | pack(rd, 7, 5) | pack(4, 12, 3) | pack(rs1, 15, 5) | pack(0xFFF, 20, 12);
-                    i = idx;
-                }
-            }
-            else if (def.type == InstrType::R_TYPE) {
-                uint8_t rd  = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                uint8_t rs1 = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                uint8_t rs2 = ISA::getRegister(next(idx).text).value();
-                instr = pack(def.opcode, 0, 7) | pack(rd, 7, 5) | pack(def.funct3, 12, 3) | pack(rs1, 15, 5) | pack(rs2, 20, 5) | pack(def.funct7, 25, 7);
-                i = idx;
+    ~AsmServer() {
+        ::close(listener);
+        if (bound) ::unlink(path.c_str());
+    }
+
+    AsmServer(const AsmServer&) = delete;
+    AsmServer& operator=(const AsmServer&) = delete;
+
+    // Accepts connections until stop() is called.
+    void serve() {
+        for (;;) {
+            int fd = ::accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;
             }
-            else if (def.type == InstrType::I_TYPE) {
-                uint8_t rd = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                if (tk.text == "lw" || tk.text == "lb" || tk.text == "lh" || tk.text == "lbu" || tk.text == "lhu") {
-                    // lw rd, off(rs1)
-                    int32_t imm = parseImmediate(next(idx).text);
-                    next(idx); // (
-                    uint8_t rs1 = ISA::getRegister(next(idx).text).value();
-                    next(idx); // )
-                    instr = pack(def.opcode, 0, 7) | pack(rd, 7, 5) | pack(def.funct3, 12, 3) | pack(rs1, 15, 5) | pack(static_cast<uint32_t>(imm) & 0xFFF, 20, 12);
-                } else {
-                    // addi rd, rs1, imm
-                    uint8_t rs1 = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                    int32_t imm = parseImmediate(next(idx).text);
-                    instr = pack(def.opcode, 0, 7) | pack(rd, 7, 5) | pack(def.funct3, 12, 3) | pack(rs1, 15, 5) | pack(static_cast<uint32_t>(imm) & 0xFFF, 20, 12);
-                }
-                i = idx;
+            std::thread(serveConnection, fd).detach();
+        }
+    }
+
+    void stop() { ::shutdown(listener, SHUT_RDWR); }
+};
+#endif
+
+#ifndef RV32_ASM_NO_MAIN
+// Counting allocator for --stats: every operator new in the process comes
+// through here. Without --stats it costs one predictable branch; main sets
+// the flag before any thread starts, so it needs no synchronization.
+static bool gCountAllocations = false;
+static std::atomic<size_t> gAllocations{0}, gAllocatedBytes{0};
+
+void* operator new(std::size_t n) {
+    if (gCountAllocations) {
+        gAllocations.fetch_add(1, std::memory_order_relaxed);
+        gAllocatedBytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+// Out of line: GCC flags free() on operator new results once it inlines these.
+#if defined(__GNUC__)
+#define RV32_NOINLINE __attribute__((noinline))
+#else
+#define RV32_NOINLINE
+#endif
+RV32_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+RV32_NOINLINE void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+// --stats: wall and CPU time, allocations and bytes per phase of one run,
+// then what was assembled and the peak RSS.
+class RunStats {
+public:
+    struct Phase {
+        std::string_view name;
+        double wallMs = 0, cpuMs = 0;
+        size_t allocations = 0, bytes = 0;
+    };
+
+    size_t sourceBytes = 0, tokens = SIZE_MAX, instructions = 0, labels = 0; // tokens: SIZE_MAX if never materialized
+    const ImageCache* cache = nullptr;
+
+    void begin(std::string_view name) {
+        open = {name, 0, 0, gAllocations.load(std::memory_order_relaxed), gAllocatedBytes.load(std::memory_order_relaxed)};
+        wall0 = std::chrono::steady_clock::now();
+        cpu0 = cpuSeconds();
+    }
+    void end() {
+        open.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - wall0).count();
+        open.cpuMs = (cpuSeconds() - cpu0) * 1e3;
+        open.allocations = gAllocations.load(std::memory_order_relaxed) - open.allocations;
+        open.bytes = gAllocatedBytes.load(std::memory_order_relaxed) - open.bytes;
+        phases.push_back(open);
+    }
+    void record(const rv32::Assembler& asmCore) {
+        instructions = asmCore.output().size();
+        labels = asmCore.symbolCount();
+    }
+
+    void print(bool json) const {
+        Phase total{"total"};
+        for (const Phase& p : phases) {
+            total.wallMs += p.wallMs;
+            total.cpuMs += p.cpuMs;
+            total.allocations += p.allocations;
+            total.bytes += p.bytes;
+        }
+        std::ostringstream os;
+        os << std::fixed << std::setprecision(3);
+        if (json) {
+            os << "{\"phases\": [";
+            for (size_t i = 0; i <= phases.size(); ++i) {
+                const Phase& p = i < phases.size() ? phases[i] : total;
+                os << (i ? ", " : "") << "{\"name\": \"" << p.name << "\", \"wall_ms\": " << p.wallMs << ", \"cpu_ms\": " << p.cpuMs
+                   << ", \"allocations\": " << p.allocations << ", \"allocated_bytes\": " << p.bytes << "}";
             }
-            else if (def.type == InstrType::S_TYPE) {
-                // sw rs2, off(rs1)
-                uint8_t rs2 = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                int32_t imm = parseImmediate(next(idx).text);
-                next(idx); // (
-                uint8_t rs1 = ISA::getRegister(next(idx).text).value();
-                next(idx); // )
-                
-                uint32_t imm_low = static_cast<uint32_t>(imm) & 0x1F;
-                uint32_t imm_high = (static_cast<uint32_t>(imm) >> 5) & 0x7F;
-                instr = pack(def.opcode, 0, 7) | pack(imm_low, 7, 5) | pack(def.funct3, 12, 3) | pack(rs1, 15, 5) | pack(rs2, 20, 5) | pack(imm_high, 25, 7);
-                i = idx;
+            os << "], \"source_bytes\": " << sourceBytes;
+            if (tokens != SIZE_MAX) os << ", \"tokens\": " << tokens;
+            os << ", \"instructions\": " << instructions << ", \"labels\": " << labels
+               << ", \"peak_rss_kb\": " << peakRssKb();
+#if RV32_HAVE_MMAP
+            if (cache) {
+                const ImageCache::Stats& st = cache->stats();
+                os << ", \"cache\": {\"hits\": " << st.hits << ", \"misses\": " << st.misses << ", \"stores\": " << st.stores
+                   << ", \"evictions\": " << st.evictions << "}";
             }
-            else if (def.type == InstrType::B_TYPE) {
-                // beq rs1, rs2, label
-                uint8_t rs1 = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                uint8_t rs2 = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                std::string labelName(next(idx).text);
-
-                if (symbolTable.find(labelName) == symbolTable.end()) throw std::runtime_error("Undefined label: " + labelName);
-                int32_t offset = static_cast<int32_t>(symbolTable[labelName] - currentPC);
-                if (offset % 2 != 0) throw std::runtime_error("Branch offset must be even");
-                
-                uint32_t imm_s = static_cast<uint32_t>(offset >> 1) & 0xFFF;
-                uint32_t imm_12   = (imm_s >> 11) & 0x1;
-                uint32_t imm_10_5 = (imm_s >> 5) & 0x3F;
-                uint32_t imm_4_1  = (imm_s >> 1) & 0xF;
-                uint32_t imm_11   = (imm_s >> 10) & 0x1;
-
-                instr = pack(def.opcode, 0, 7) | pack(imm_11, 7, 1) | pack(imm_4_1, 8, 4) | pack(def.funct3, 12, 3) 
-                      | pack(rs1, 15, 5) | pack(rs2, 20, 5) | pack(imm_10_5, 25, 6) | pack(imm_12, 31, 1);
-                i = idx;
+#endif
+            os << "}\n";
+        } else {
+            os << "[Stats] " << std::left << std::setw(14) << "phase" << std::right << std::setw(12) << "wall ms"
+               << std::setw(12) << "cpu ms" << std::setw(10) << "allocs" << std::setw(12) << "alloc KiB" << "\n";
+            for (size_t i = 0; i <= phases.size(); ++i) {
+                const Phase& p = i < phases.size() ? phases[i] : total;
+                os << "        " << std::left << std::setw(14) << p.name << std::right << std::setw(12) << p.wallMs
+                   << std::setw(12) << p.cpuMs << std::setw(10) << p.allocations << std::setw(12) << p.bytes / 1024 << "\n";
             }
-            else if (def.type == InstrType::U_TYPE) {
-                uint8_t rd = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                int32_t imm = parseImmediate(next(idx).text);
-                instr = pack(def.opcode, 0, 7) | pack(rd, 7, 5) | pack(static_cast<uint32_t>(imm) & 0xFFFFF, 12, 20);
-                i = idx;
+            os << "[Stats] " << sourceBytes << " source bytes, ";
+            if (tokens != SIZE_MAX) os << tokens << " tokens, ";
+            os << instructions << " instructions, " << labels << " labels; peak RSS " << peakRssKb() << " KiB\n";
+#if RV32_HAVE_MMAP
+            if (cache) {
+                const ImageCache::Stats& st = cache->stats();
+                os << "[Stats] cache: " << st.hits << " hits, " << st.misses << " misses, " << st.stores << " stored, "
+                   << st.evictions << " evicted\n";
             }
-            else if (def.type == InstrType::J_TYPE) {
-                 // jal rd, label
-                 uint8_t rd = ISA::getRegister(next(idx).text).value(); next(idx); // ,
-                 std::string labelName(next(idx).text);
-                 
-                 if (symbolTable.find(labelName) == symbolTable.end()) throw std::runtime_error("Undefined label: " + labelName);
-                 int32_t offset = static_cast<int32_t>(symbolTable[labelName] - currentPC);
-                 if (offset % 2 != 0) throw std::runtime_error("Jump offset must be even");
-
-                 uint32_t imm_s = static_cast<uint32_t>(offset >> 1) & 0xFFFFF; // 20 bits
-                 uint32_t imm_20 = (imm_s >> 19) & 0x1;
-                 uint32_t imm_10_1 = imm_s & 0x3FF;
-                 uint32_t imm_11 = (imm_s >> 10) & 0x1;
-                 uint32_t imm_19_12 = (imm_s >> 11) & 0xFF;
-
-                 instr = pack(def.opcode, 0, 7) | pack(rd, 7, 5) | pack(imm_19_12, 12, 8) 
-                       | pack(imm_11, 20, 1) | pack(imm_10_1, 21, 10) | pack(imm_20, 31, 1);
-                 i = idx;
+#endif
+        }
+        std::cerr << os.str() << std::flush;
+    }
+
+private:
+    std::vector<Phase> phases;
+    Phase open;
+    std::chrono::steady_clock::time_point wall0;
+    double cpu0 = 0;
+
+    // Process CPU time, every thread included.
+    static double cpuSeconds() {
+#if RV32_HAVE_RUSAGE
+        rusage ru{};
+        ::getrusage(RUSAGE_SELF, &ru);
+        return static_cast<double>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+#else
+        return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+#endif
+    }
+    static size_t peakRssKb() {
+#if RV32_HAVE_RUSAGE
+        rusage ru{};
+        ::getrusage(RUSAGE_SELF, &ru);
+#if defined(__APPLE__)
+        return static_cast<size_t>(ru.ru_maxrss) / 1024; // bytes there
+#else
+        return static_cast<size_t>(ru.ru_maxrss);
+#endif
+#else
+        return 0;
+#endif
+    }
+};
+
+struct FormatOption {
+    std::string_view name;
+    rv32::ImageFormat format;
+    const char* extension;
+    const char* label;
+};
+static constexpr FormatOption kFormats[] = {
+    {"hex",  rv32::ImageFormat::Hex,      ".hex",  "Hex"},
+    {"memh", rv32::ImageFormat::Memh,     ".memh", "$readmemh"},
+    {"ihex", rv32::ImageFormat::IntelHex, ".ihx",  "Intel HEX"},
+    {"bin",  rv32::ImageFormat::Bin,      ".bin",  "Binary"},
+    {"elf",  rv32::ImageFormat::Elf,      ".elf",  "ELF"},
+};
+
+static void writeImage(const std::vector<rv32::ImageSegment>& image, const FormatOption& fmt, const std::string& filename) {
+    rv32::ImageWriter writer;
+    writer.render(image, fmt.format);
+    writer.save(filename);
+    std::cout << "[Info] " << fmt.label << " file written to " << filename << "\n";
+}
+
+// Prints every diagnostic of the last run; true if there were any.
+static bool reportDiagnostics(const std::vector<rv32::Diagnostic>& diagnostics) {
+    for (const rv32::Diagnostic& d : diagnostics)
+        std::cerr << "[Error] " << d.message << " at line " << d.line << "\n";
+    return !diagnostics.empty();
+}
+
+// Every input named by `spec`: the *.s files under a directory (sorted), or
+// the paths listed one per line in a file ('#' comments, "-" for stdin).
+static std::vector<std::string> batchInputs(const char* spec) {
+    namespace fs = std::filesystem;
+    std::vector<std::string> files;
+    if (std::string_view(spec) != "-" && fs::is_directory(spec)) {
+        for (const auto& entry : fs::recursive_directory_iterator(spec))
+            if (entry.is_regular_file() && entry.path().extension() == ".s") files.push_back(entry.path().string());
+        std::sort(files.begin(), files.end());
+        return files;
+    }
+    SourceFile list(spec);
+    std::string_view text = list.view();
+    while (!text.empty()) {
+        size_t eol = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, eol);
+        text.remove_prefix(std::min(eol + 1, text.size()));
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.back()))) line.remove_suffix(1);
+        while (!line.empty() && std::isspace(static_cast<unsigned char>(line.front()))) line.remove_prefix(1);
+        if (!line.empty() && line.front() != '#') files.emplace_back(line);
+    }
+    return files;
+}
+
+// --batch: assembles every input on a work-stealing pool. Each worker keeps
+// one Assembler and one ImageWriter for all of its files, so after the first
+// few inputs the buffers are warm and a file costs no allocations beyond its
+// diagnostics. With a cache, workers share it and unchanged files skip the
+// assembler. Prints one status line per file, in input order, then totals.
+static int runBatch(const char* spec, unsigned jobs, const FormatOption& fmt, ImageCache* cache) {
+    const std::vector<std::string> files = batchInputs(spec);
+    if (jobs == 0) jobs = std::max(1u, std::thread::hardware_concurrency());
+
+    struct Result {
+        bool ok = false;
+        size_t bytes = 0, words = 0;
+        std::vector<std::string> errors;
+    };
+    struct Worker {
+        rv32::Assembler asmCore;
+        rv32::ImageWriter writer;
+#if RV32_HAVE_MMAP
+        ImageCache::Entry hit;
+#endif
+    };
+    std::vector<Result> results(files.size());
+    std::vector<Worker> workers(jobs);
+
+    const auto t0 = std::chrono::steady_clock::now();
+    rv32::detail::forEachStealing(files.size(), jobs, [&](unsigned w, size_t i) {
+        Result& r = results[i];
+        Worker& worker = workers[w];
+        try {
+            SourceFile source(files[i].c_str());
+            r.bytes = source.view().size();
+#if RV32_HAVE_MMAP
+            if (cache && cache->lookup(source.view(), worker.hit)) {
+                for (const rv32::ImageSegment& seg : worker.hit.image()) r.words += seg.count;
+                worker.writer.render(worker.hit.image(), fmt.format);
+                worker.writer.save(files[i] + fmt.extension);
+                r.ok = true;
+                return;
             }
-            
-            binaryOutput.push_back(instr);
-            currentPC += 4;
+#endif
+            worker.asmCore.assemble(source.view());
+            for (const rv32::Diagnostic& d : worker.asmCore.diagnostics())
+                r.errors.push_back(d.message + " at line " + std::to_string(d.line));
+            if (!r.errors.empty()) return;
+#if RV32_HAVE_MMAP
+            if (cache) cache->store(source.view(), worker.asmCore);
+#endif
+            r.words = worker.asmCore.output().size();
+            worker.writer.render(worker.asmCore.image(), fmt.format);
+            worker.writer.save(files[i] + fmt.extension);
+            r.ok = true;
+        } catch (const std::exception& e) {
+            r.errors.push_back(e.what());
+        }
+    });
+    const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    size_t failed = 0, bytes = 0, words = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        const Result& r = results[i];
+        bytes += r.bytes;
+        words += r.words;
+        if (r.ok) {
+            std::cout << "[ OK ] " << files[i] << " (" << r.words << " words)\n";
+        } else {
+            ++failed;
+            std::cout << "[FAIL] " << files[i] << "\n";
+            for (const std::string& e : r.errors) std::cout << "       " << e << "\n";
         }
     }
+    std::cout << std::fixed << std::setprecision(3)
+              << "Batch: " << files.size() << " files, " << files.size() - failed << " ok, " << failed << " failed, "
+              << jobs << " thread(s), " << secs << " s\n" << std::setprecision(1)
+              << "       " << files.size() / secs << " files/s, " << bytes / secs / (1 << 20) << " MiB/s, "
+              << words / secs / 1e6 << " M instr/s\n";
+#if RV32_HAVE_MMAP
+    if (cache) {
+        const ImageCache::Stats& st = cache->stats();
+        std::cout << "       cache: " << st.hits << " hits, " << st.misses << " misses, " << st.stores << " stored, "
+                  << st.evictions << " evicted\n";
+    }
+#endif
+    return failed ? 1 : 0;
+}
 
-    void exportHex(const std::string& filename) {
-        std::ofstream out(filename);
-        if (!out) throw std::runtime_error("Could not open output file " + filename);
-        out << std::hex << std::setfill('0');
-        for (auto word : binaryOutput) {
-            out << std::setw(8) << (word & 0xFFFFFFFFu) << "\n";
+#if RV32_HAVE_INOTIFY
+// Brings the hex file of the previous update in line with `words`: runs of
+// words changed in place are rewritten where they stand (9 bytes a word), and
+// if words were added or removed, everything from the first moved one on.
+// Runs less than a page apart go out as one write, unchanged words and all.
+// False if the file is gone, so the caller writes it whole.
+static bool patchHex(const std::string& filename, const std::vector<rv32::InstructionCode>& words,
+                     const rv32::IncrementalAssembler::Delta& d, rv32::ImageWriter& writer) {
+    const int fd = ::open(filename.c_str(), O_WRONLY);
+    if (fd < 0) return false;
+    auto put = [&](size_t first, size_t count) {
+        const std::string& bytes = writer.render({{0, words.data() + first, count}}, rv32::ImageFormat::Hex);
+        if (::pwrite(fd, bytes.data(), bytes.size(), static_cast<off_t>(first * 9)) != static_cast<ssize_t>(bytes.size())) {
+            ::close(fd);
+            throw std::runtime_error("Could not write output file " + filename);
         }
-        std::cout << "[Info] Hex file written to " << filename << "\n";
+    };
+    for (size_t i = 0; i < d.rewritten.size();) {
+        size_t j = i + 1;
+        while (j < d.rewritten.size() && d.rewritten[j] - d.rewritten[j - 1] <= 4096 / 9) ++j;
+        put(d.rewritten[i], d.rewritten[j - 1] + 1 - d.rewritten[i]);
+        i = j;
     }
-};
+    if (d.shiftedFrom < words.size()) put(d.shiftedFrom, words.size() - d.shiftedFrom);
+    const bool ok = d.shiftedFrom == SIZE_MAX || ::ftruncate(fd, static_cast<off_t>(words.size() * 9)) == 0;
+    ::close(fd);
+    if (!ok) throw std::runtime_error("Could not write output file " + filename);
+    return true;
+}
 
-} // namespace rv32
+// --watch: assembles `input` to <input>.hex, then again on every save. Each
+// update goes through an IncrementalAssembler and rewrites only the hex
+// records that changed. The directory is watched rather than the file, so
+// editors that save by renaming a new file into place are seen too.
+static int runWatch(const char* input) {
+    const std::filesystem::path path(input);
+    const std::string dir = path.has_parent_path() ? path.parent_path().string() : ".";
+    const std::string name = path.filename().string();
+    const std::string outFile = std::string(input) + ".hex";
+    const int fd = ::inotify_init1(IN_CLOEXEC);
+    if (fd < 0 || ::inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        throw std::runtime_error("Could not watch " + dir);
 
-// ---------------- DRIVER ----------------
-std::string readFile(const char* filename) {
-    std::ifstream in(filename, std::ios::in | std::ios::binary);
-    if (!in) throw std::runtime_error("Could not open file");
-    std::string contents;
-    in.seekg(0, std::ios::end);
-    std::streampos len = in.tellg();
-    if (len > 0) {
-        contents.resize(static_cast<size_t>(len));
-        in.seekg(0, std::ios::beg);
-        in.read(&contents[0], contents.size());
-    } else {
-        in.clear(); in.seekg(0);
-        contents.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    rv32::IncrementalAssembler inc;
+    rv32::ImageWriter writer;
+    bool written = false; // outFile matches the last clean update
+    auto update = [&] {
+        try {
+            const auto t0 = std::chrono::steady_clock::now();
+            const auto& d = inc.update(readFile(input));
+            if (reportDiagnostics(inc.diagnostics())) {
+                written = false;
+                return;
+            }
+            const std::vector<rv32::InstructionCode>& words = inc.output();
+            if (d.full || !written || !patchHex(outFile, words, d, writer)) {
+                writer.render({{0, words.data(), words.size()}}, rv32::ImageFormat::Hex);
+                writer.save(outFile);
+            }
+            written = true;
+            const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+            std::cout << "[Watch] " << (d.full ? "full: " : "") << d.linesRelexed << " line(s) lexed, ";
+            if (d.full) std::cout << words.size() << " word(s) written";
+            else std::cout << d.rewritten.size() << " word(s) rewritten"
+                           << (d.shiftedFrom != SIZE_MAX ? ", tail from word " + std::to_string(d.shiftedFrom) : std::string());
+            std::cout << ", " << std::fixed << std::setprecision(3) << ms << " ms\n" << std::flush;
+        } catch (const std::exception& e) {
+            std::cerr << "[Error] " << e.what() << "\n";
+        }
+    };
+
+    update();
+    std::cout << "Watching " << input << " (Ctrl-C to stop)\n" << std::flush;
+    alignas(inotify_event) char buf[4096];
+    for (;;) {
+        const ssize_t n = ::read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) throw std::runtime_error("Lost the watch on " + dir);
+        bool changed = false;
+        for (ssize_t off = 0; off < n;) {
+            const auto* ev = reinterpret_cast<const inotify_event*>(buf + off);
+            if (ev->len && name == ev->name) changed = true;
+            off += static_cast<ssize_t>(sizeof(inotify_event) + ev->len);
+        }
+        if (changed) update(); // one update for however many events one save produced
     }
-    return contents;
 }
+#endif
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        std::cerr << "Usage: rv32_asm <input.s>\n";
+    bool streaming = false, onePass = false, batch = false, serve = false, watch = false;
+    int stats = 0; // 1: text, 2: JSON
+    unsigned jobs = 0;
+    const FormatOption* format = &kFormats[0];
+    const char* input = nullptr;
+    const char* cacheDir = nullptr;
+    uint64_t cacheMiB = 1024;
+    for (int a = 1; a < argc; ++a) {
+        std::string_view arg(argv[a]);
+        if (arg == "--stream") streaming = true;
+        else if (arg == "--one-pass") onePass = true;
+        else if (arg == "--batch") batch = true;
+        else if (arg == "--serve") serve = true;
+        else if (arg == "--watch") watch = true;
+        else if (arg == "--stats" || arg == "--stats=text") stats = 1;
+        else if (arg == "--stats=json") stats = 2;
+        else if (arg == "-j" && a + 1 < argc) jobs = static_cast<unsigned>(std::strtoul(argv[++a], nullptr, 10));
+        else if (arg == "--cache" && a + 1 < argc) cacheDir = argv[++a];
+        else if (arg == "--cache-max" && a + 1 < argc) cacheMiB = std::strtoull(argv[++a], nullptr, 10);
+        else if (arg == "--format" && a + 1 < argc) {
+            std::string_view name(argv[++a]);
+            format = nullptr;
+            for (const FormatOption& f : kFormats)
+                if (f.name == name) format = &f;
+        }
+        else input = argv[a];
+    }
+    if (!input || !format || (streaming + onePass + batch + serve + watch + (jobs > 0 && !batch) > 1) ||
+        ((streaming || watch) && format != &kFormats[0]) || (cacheDir && (streaming || serve || watch)) ||
+        (stats && (batch || serve || watch))) {
+        std::cerr << "Usage: rv32_asm [--stream | --one-pass | -j N] [--format hex|memh|ihex|bin|elf] [--cache dir]\n"
+                     "                [--stats[=text|json]] <input.s | ->\n"
+                     "       rv32_asm --batch [-j N] [--format ...] [--cache dir] <list.txt | directory | ->\n"
+                     "       rv32_asm --serve <socket-path>\n"
+                     "       rv32_asm --watch <input.s>\n"
+                     "       (--stream and --watch write hex only and do not use the cache;\n"
+                     "        --cache-max MiB bounds the cache directory, default 1024;\n"
+                     "        --stats prints phase times, allocations and peak RSS to stderr)\n";
         return 1;
     }
+    gCountAllocations = stats != 0;
     try {
-        std::string source = readFile(argv[1]);
-        rv32::Lexer lexer(source);
-        auto tokens = lexer.tokenize();
+#if RV32_HAVE_MMAP
+        std::optional<ImageCache> cacheStore;
+        if (cacheDir) cacheStore.emplace(cacheDir, cacheMiB << 20);
+        ImageCache* cache = cacheStore ? &*cacheStore : nullptr;
+#else
+        if (cacheDir) throw std::runtime_error("--cache needs mmap");
+        ImageCache* cache = nullptr;
+#endif
+        if (batch) return runBatch(input, jobs, *format, cache);
+        if (watch) {
+#if RV32_HAVE_INOTIFY
+            return runWatch(input);
+#else
+            throw std::runtime_error("--watch needs inotify");
+#endif
+        }
+        if (serve) {
+#if RV32_HAVE_UNIX_SOCKETS
+            AsmServer server(input);
+            std::cout << "Serving on " << input << "\n" << std::flush;
+            server.serve();
+            return 0;
+#else
+            throw std::runtime_error("--serve needs Unix domain sockets");
+#endif
+        }
+
+        RunStats run;
+        run.cache = cache;
+        auto done = [&](int status) {
+            if (stats) run.print(stats == 2);
+            return status;
+        };
+
+        run.begin("read");
+        SourceFile source(input);
+        run.end();
+        run.sourceBytes = source.view().size();
+        std::string outFile = (std::string_view(input) == "-" ? std::string("stdin") : std::string(input)) + format->extension;
+
+#if RV32_HAVE_MMAP
+        if (cache && !streaming) {
+            ImageCache::Entry hit;
+            run.begin("cache lookup");
+            const bool found = cache->lookup(source.view(), hit);
+            run.end();
+            if (found) {
+                std::cout << "[Info] Cache hit\n";
+                for (const rv32::ImageSegment& seg : hit.image()) run.instructions += seg.count;
+                run.begin("export");
+                writeImage(hit.image(), *format, outFile);
+                run.end();
+                std::cout << "Assembly Complete.\n";
+                return done(0);
+            }
+            std::cout << "[Info] Cache miss\n";
+        }
+#endif
+        auto finish = [&](const rv32::Assembler& asmCore) {
+            run.record(asmCore);
+            if (reportDiagnostics(asmCore.diagnostics())) return done(1);
+#if RV32_HAVE_MMAP
+            if (cache) {
+                run.begin("cache store");
+                cache->store(source.view(), asmCore);
+                run.end();
+            }
+#endif
+            run.begin("export");
+            writeImage(asmCore.image(), *format, outFile);
+            run.end();
+            std::cout << "Assembly Complete.\n";
+            return done(0);
+        };
+
+        if (streaming) {
+            // Bounded memory: tokens and words are never materialized.
+            rv32::Assembler asmCore;
+            std::cout << "Pass 1: Symbol Resolution (streaming)...\n";
+            run.begin("pass1");
+            asmCore.pass1Streaming(source.view());
+            run.end();
+            std::ofstream out(outFile, std::ios::binary);
+            if (!out) throw std::runtime_error("Could not open output file " + outFile);
+            // Words go out in fixed chunks through the ImageWriter, so memory
+            // stays bounded and formatting runs at its speed, not ostream's.
+            constexpr size_t kChunkWords = 4096;
+            std::vector<rv32::InstructionCode> chunk;
+            chunk.reserve(kChunkWords);
+            rv32::ImageWriter writer;
+            std::vector<rv32::ImageSegment> view(1);
+            auto flush = [&] {
+                view[0] = {0, chunk.data(), chunk.size()};
+                const std::string& text = writer.render(view, rv32::ImageFormat::Hex);
+                out.write(text.data(), static_cast<std::streamsize>(text.size()));
+                chunk.clear();
+            };
+            std::cout << "Pass 2: Binary Generation (streaming)...\n";
+            run.begin("pass2+export"); // words go out as they are encoded
+            asmCore.pass2Streaming(source.view(), [&](rv32::InstructionCode word) {
+                chunk.push_back(word);
+                if (chunk.size() == kChunkWords) flush();
+                ++run.instructions;
+            });
+            flush();
+            out.close();
+            if (!out) throw std::runtime_error("Could not write output file " + outFile);
+            run.end();
+            run.labels = asmCore.symbolCount();
+            if (reportDiagnostics(asmCore.diagnostics())) {
+                std::remove(outFile.c_str());
+                return done(1);
+            }
+            std::cout << "[Info] Hex file written to " << outFile << "\n";
+            std::cout << "Assembly Complete.\n";
+            return done(0);
+        }
+
+        if (onePass) {
+            rv32::Assembler asmCore;
+            std::cout << "One-pass assembly with fixups...\n";
+            run.begin("assemble"); // lexing included: tokens are pulled as encoded
+            asmCore.assembleOnePass(source.view());
+            run.end();
+            return finish(asmCore);
+        }
+
+        if (jobs > 0) {
+            rv32::Assembler asmCore;
+            std::cout << "Parallel assembly on " << jobs << " thread(s)...\n";
+            run.begin("assemble"); // lexing included; cpu ms covers every thread
+            asmCore.assembleParallel(source.view(), jobs);
+            run.end();
+            return finish(asmCore);
+        }
+
+        run.begin("tokenize");
+        rv32::Lexer lexer(source.view());
+        auto tokens = lexer.tokenizePacked();
+        run.end();
+        run.tokens = tokens.size();
 
         rv32::Assembler asmCore(std::move(tokens));
         std::cout << "Pass 1: Symbol Resolution...\n";
+        run.begin("pass1");
         asmCore.pass1();
+        run.end();
         std::cout << "Pass 2: Binary Generation...\n";
+        run.begin("pass2");
         asmCore.pass2();
-
-        std::string outFile = std::string(argv[1]) + ".hex";
-        asmCore.exportHex(outFile);
-
-        std::cout << "Assembly Complete.\n";
+        run.end();
+        return finish(asmCore);
     } catch (const std::exception& e) {
         std::cerr << "[Error] " << e.what() << "\n";
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif // RV32_ASM_NO_MAIN
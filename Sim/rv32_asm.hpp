@@ -0,0 +1,2328 @@
+// rv32_asm.hpp
+// The assembler engine: lexer, two-pass assembler, image writers and
+// compile-time assembly, on top of the ISA description in rv32_isa.hpp.
+// Header-only; rv32_asm.cpp (driver), rv32asm_capi.cpp (C ABI) and
+// rv32_bench.cpp all build on it.
+
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <variant>
+#include <iomanip>
+#include <stdexcept>
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <charconv>
+#include <algorithm>
+#include <iterator>
+#include <array>
+#include <thread>
+#include <mutex>
+#include <deque>
+#include <exception>
+#include <type_traits>
+
+#include "rv32_isa.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+namespace rv32 {
+
+using Address = uint32_t;
+
+struct Token {
+    enum Kind { Label, Mnemonic, Register, Immediate, Comma, LParen, RParen, Directive, EndOfLine };
+    Kind kind;
+    std::string_view text; // points into original source string
+    size_t lineNum;
+};
+
+// Packed struct-of-arrays token storage: 1-byte kind, 32-bit source offset,
+// 16-bit length and a 32-bit payload per token (11 bytes instead of
+// sizeof(Token) == 32). The payload is what the lexer already resolved: the
+// register number, the ISA definition index, the immediate's value, or for
+// labels and other words their symbol hash (always negative, so "not an
+// instruction" stays a sign test). Line numbers are not stored; they are recovered on demand
+// from a line-offset index built the first time a diagnostic needs one.
+class TokenStream {
+    std::string_view src;
+    std::vector<uint8_t> kinds;
+    std::vector<uint32_t> offsets;
+    std::vector<uint16_t> lengths;
+    std::vector<int32_t> values;
+    mutable std::vector<uint32_t> lineStarts; // lazily built, not thread-safe
+    size_t firstLine = 1;                     // line number of src[0]
+
+public:
+    // Lightweight view of one token, as consumed by the assembler passes.
+    struct Ref {
+        Token::Kind kind;
+        std::string_view text;
+        int32_t value;
+    };
+
+    TokenStream() = default;
+    explicit TokenStream(std::string_view source, size_t firstLine = 1) : src(source), firstLine(firstLine) {
+        if (source.size() > UINT32_MAX) throw std::runtime_error("Source larger than 4 GiB");
+    }
+
+    void reserve(size_t n) { kinds.reserve(n); offsets.reserve(n); lengths.reserve(n); values.reserve(n); }
+
+    // Empties the stream for a new source but keeps every buffer's capacity.
+    void reset(std::string_view source, size_t first = 1) {
+        if (source.size() > UINT32_MAX) throw std::runtime_error("Source larger than 4 GiB");
+        src = source;
+        firstLine = first;
+        kinds.clear(); offsets.clear(); lengths.clear(); values.clear(); lineStarts.clear();
+    }
+
+    void push(Token::Kind kind, size_t offset, size_t len, int32_t value = 0) {
+        if (len > UINT16_MAX) throw std::runtime_error("Token too long at line " + std::to_string(lineAt(offset)));
+        kinds.push_back(static_cast<uint8_t>(kind));
+        offsets.push_back(static_cast<uint32_t>(offset));
+        lengths.push_back(static_cast<uint16_t>(len));
+        values.push_back(value);
+    }
+
+    size_t size() const { return kinds.size(); }
+    Token::Kind kind(size_t i) const { return static_cast<Token::Kind>(kinds[i]); }
+    std::string_view text(size_t i) const { return src.substr(offsets[i], lengths[i]); }
+    int32_t value(size_t i) const { return values[i]; }
+    Ref operator[](size_t i) const { return {kind(i), text(i), value(i)}; }
+
+    size_t lineOf(size_t i) const { return lineAt(offsets[i]); }
+
+    // 1-based line containing the source byte at `offset`.
+    size_t lineAt(size_t offset) const {
+        if (lineStarts.empty()) {
+            lineStarts.push_back(0);
+            for (size_t p = src.find('\n'); p != std::string_view::npos; p = src.find('\n', p + 1))
+                lineStarts.push_back(static_cast<uint32_t>(p + 1));
+        }
+        return firstLine - 1 + static_cast<size_t>(std::upper_bound(lineStarts.begin(), lineStarts.end(), offset) - lineStarts.begin());
+    }
+
+    Token materialize(size_t i) const { return {kind(i), text(i), lineOf(i)}; }
+
+    size_t bytes() const {
+        return kinds.capacity() * sizeof(uint8_t) + offsets.capacity() * sizeof(uint32_t)
+             + lengths.capacity() * sizeof(uint16_t) + values.capacity() * sizeof(int32_t)
+             + lineStarts.capacity() * sizeof(uint32_t);
+    }
+};
+
+// ============================================================================
+// 1. ISA DATABASE
+// ============================================================================
+// The instruction table, encode/decode and the compile-time hash tables live
+// in rv32_isa.hpp.
+namespace detail {
+
+// Case-sensitive hash of a label name. The top bit is always set: it marks a
+// word token as a symbol and doubles as the symbol table's occupied flag.
+constexpr int32_t symbolHash(std::string_view s) {
+    uint32_t h = 0x811C9DC5u;
+    for (char c : s) h = (h ^ static_cast<uint8_t>(c)) * 0x01000193u;
+    return static_cast<int32_t>((h ^ (h >> 15)) | 0x80000000u);
+}
+
+} // namespace detail
+
+// ============================================================================
+// 2. LEXER
+// ============================================================================
+namespace detail {
+
+// Character classes matching <cctype> in the "C" locale, without the locale
+// lookups or the branches.
+enum CharClass : uint8_t {
+    CC_Space = 1 << 0, // ' ' \t \n \v \f \r
+    CC_Alpha = 1 << 1, // [A-Za-z_] : may start a word
+    CC_Digit = 1 << 2, // [0-9]
+    CC_Hex   = 1 << 3, // [0-9A-Fa-f]
+    CC_Word  = CC_Alpha | CC_Digit,
+};
+
+constexpr std::array<uint8_t, 256> makeCharClassTable() {
+    std::array<uint8_t, 256> t = {};
+    for (int c : {' ', '\t', '\n', '\v', '\f', '\r'}) t[c] |= CC_Space;
+    for (int c = 'a'; c <= 'z'; ++c) t[c] |= CC_Alpha;
+    for (int c = 'A'; c <= 'Z'; ++c) t[c] |= CC_Alpha;
+    t['_'] |= CC_Alpha;
+    for (int c = '0'; c <= '9'; ++c) t[c] |= CC_Digit | CC_Hex;
+    for (int c = 'a'; c <= 'f'; ++c) t[c] |= CC_Hex;
+    for (int c = 'A'; c <= 'F'; ++c) t[c] |= CC_Hex;
+    return t;
+}
+
+inline constexpr std::array<uint8_t, 256> kCharClass = makeCharClassTable();
+
+constexpr bool isClass(char c, uint8_t cls) {
+    return (kCharClass[static_cast<uint8_t>(c)] & cls) != 0;
+}
+
+// Integer literal with the std::stoll(..., 0) rules the encoder always used:
+// optional sign, then 0x-hex, leading-zero octal or decimal, parsing stops at
+// the first digit outside the base. The result wraps to 32 bits. No locale,
+// no allocation, no exceptions, and usable in constant expressions.
+constexpr bool parseInteger(std::string_view s, int32_t& out) {
+    size_t i = 0;
+    bool neg = false;
+    if (i < s.size() && (s[i] == '+' || s[i] == '-')) neg = (s[i++] == '-');
+    if (i >= s.size() || !isClass(s[i], CC_Digit)) return false;
+
+    unsigned base = 10;
+    if (s[i] == '0' && i + 1 < s.size() && (s[i+1] == 'x' || s[i+1] == 'X')) {
+        if (i + 2 < s.size() && isClass(s[i+2], CC_Hex)) { base = 16; i += 2; }
+        else { out = 0; return true; } // "0x" alone reads as 0
+    } else if (s[i] == '0') {
+        base = 8;
+    }
+
+    const uint64_t limit = neg ? (uint64_t(1) << 63) : (uint64_t(1) << 63) - 1;
+    uint64_t mag = 0;
+    for (; i < s.size(); ++i) {
+        const char c = asciiLower(s[i]);
+        const unsigned digit = isClass(c, CC_Digit) ? unsigned(c - '0') : isClass(c, CC_Hex) ? unsigned(c - 'a' + 10) : base;
+        if (digit >= base) break;
+        if (mag > (limit - digit) / base) return false; // out of long long range
+        mag = mag * base + digit;
+    }
+    out = static_cast<int32_t>(static_cast<uint32_t>(neg ? (0 - mag) : mag));
+    return true;
+}
+
+// Scanners for the two hot loops of the lexer: skipping whitespace runs
+// (counting newlines) and skipping comment bodies up to the end of line.
+struct ScalarScan {
+    static constexpr size_t skipBlank(std::string_view s, size_t pos, size_t& line) {
+        while (pos < s.size() && isClass(s[pos], CC_Space)) {
+            if (s[pos] == '\n') ++line;
+            ++pos;
+        }
+        return pos;
+    }
+    static constexpr size_t findEol(std::string_view s, size_t pos) {
+        while (pos < s.size() && s[pos] != '\n') ++pos;
+        return pos;
+    }
+};
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RV32_LEX_SIMD 1
+
+struct Sse42Scan {
+    __attribute__((target("sse4.2,popcnt")))
+    static size_t skipBlank(std::string_view s, size_t pos, size_t& line) {
+        const __m128i blanks = _mm_setr_epi8(' ', '\t', '\n', '\v', '\f', '\r', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+        const __m128i nl = _mm_set1_epi8('\n');
+        while (pos + 16 <= s.size()) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+            int stop = _mm_cmpestri(blanks, 6, v, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_NEGATIVE_POLARITY);
+            unsigned nlMask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+            if (stop < 16) nlMask &= (1u << stop) - 1u;
+            line += static_cast<size_t>(__builtin_popcount(nlMask));
+            pos += static_cast<size_t>(stop);
+            if (stop < 16) return pos;
+        }
+        return ScalarScan::skipBlank(s, pos, line);
+    }
+
+    __attribute__((target("sse4.2,popcnt")))
+    static size_t findEol(std::string_view s, size_t pos) {
+        const __m128i nl = _mm_set1_epi8('\n');
+        while (pos + 16 <= s.size()) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s.data() + pos));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)));
+            if (mask) return pos + static_cast<size_t>(__builtin_ctz(mask));
+            pos += 16;
+        }
+        return ScalarScan::findEol(s, pos);
+    }
+};
+
+struct Avx2Scan {
+    __attribute__((target("avx2,popcnt")))
+    static size_t skipBlank(std::string_view s, size_t pos, size_t& line) {
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i tab = _mm256_set1_epi8('\t');
+        const __m256i ctlSpan = _mm256_set1_epi8('\r' - '\t');
+        const __m256i nl = _mm256_set1_epi8('\n');
+        while (pos + 32 <= s.size()) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.data() + pos));
+            // \t..\r are contiguous: (c - '\t') <= 4 as an unsigned byte.
+            __m256i rel = _mm256_sub_epi8(v, tab);
+            __m256i isCtl = _mm256_cmpeq_epi8(_mm256_min_epu8(rel, ctlSpan), rel);
+            __m256i isBlank = _mm256_or_si256(isCtl, _mm256_cmpeq_epi8(v, space));
+            uint32_t other = ~static_cast<uint32_t>(_mm256_movemask_epi8(isBlank));
+            uint32_t nlMask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+            if (other) {
+                unsigned stop = static_cast<unsigned>(__builtin_ctz(other));
+                line += static_cast<size_t>(__builtin_popcount(nlMask & ((1u << stop) - 1u)));
+                return pos + stop;
+            }
+            line += static_cast<size_t>(__builtin_popcount(nlMask));
+            pos += 32;
+        }
+        return Sse42Scan::skipBlank(s, pos, line);
+    }
+
+    __attribute__((target("avx2,popcnt")))
+    static size_t findEol(std::string_view s, size_t pos) {
+        const __m256i nl = _mm256_set1_epi8('\n');
+        while (pos + 32 <= s.size()) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s.data() + pos));
+            uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl)));
+            if (mask) return pos + static_cast<size_t>(__builtin_ctz(mask));
+            pos += 32;
+        }
+        return Sse42Scan::findEol(s, pos);
+    }
+};
+#else
+#define RV32_LEX_SIMD 0
+#endif
+
+} // namespace detail
+
+class Lexer {
+public:
+    // Scanning back-ends. All paths produce identical token streams.
+    enum class Path { Auto, Scalar, SSE42, AVX2 };
+
+private:
+    std::string_view src;
+    size_t cursor = 0;
+    size_t line = 1;
+
+    // Token sinks: the classic vector of fat tokens, or the packed stream.
+    struct VectorSink {
+        std::string_view src;
+        std::vector<Token> tokens;
+        void push(Token::Kind kind, size_t start, size_t len, size_t line, int32_t = 0) {
+            tokens.push_back({kind, src.substr(start, len), line});
+        }
+    };
+    struct StreamSink {
+        TokenStream& tokens;
+        void push(Token::Kind kind, size_t start, size_t len, size_t, int32_t value = 0) { tokens.push(kind, start, len, value); }
+    };
+    struct PullSink {
+        std::string_view src;
+        TokenStream::Ref& out;
+        constexpr void push(Token::Kind kind, size_t start, size_t len, size_t, int32_t value = 0) {
+            out = {kind, src.substr(start, len), value};
+        }
+    };
+    Path pullPath = Path::Auto;
+
+    // Lexes up to and including the next token; false at end of input.
+    template <typename Scan, typename Sink>
+    constexpr bool lexOne(Sink& tokens) {
+        using detail::isClass;
+        while (cursor < src.size()) {
+            char c = src[cursor];
+
+            if (c == '#') { // Comment
+                cursor = Scan::findEol(src, cursor);
+                continue;
+            }
+            if (isClass(c, detail::CC_Space)) {
+                // Single separators are the norm; only real runs go to the scanner.
+                if (c == '\n') ++line;
+                if (++cursor < src.size() && isClass(src[cursor], detail::CC_Space))
+                    cursor = Scan::skipBlank(src, cursor, line);
+                continue;
+            }
+            if (c == ',') { tokens.push(Token::Comma, cursor++, 1, line); return true; }
+            if (c == '(') { tokens.push(Token::LParen, cursor++, 1, line); return true; }
+            if (c == ')') { tokens.push(Token::RParen, cursor++, 1, line); return true; }
+
+            if (c == '.') { // Directive
+                size_t start = cursor++;
+                while (cursor < src.size() && isClass(src[cursor], detail::CC_Word)) ++cursor;
+                tokens.push(Token::Directive, start, cursor - start, line);
+                return true;
+            }
+
+            if (isClass(c, detail::CC_Alpha)) { // Words
+                size_t start = cursor;
+                while (cursor < src.size() && isClass(src[cursor], detail::CC_Word)) ++cursor;
+                if (cursor < src.size() && src[cursor] == ':') { // Label
+                    tokens.push(Token::Label, start, cursor - start, line, detail::symbolHash(src.substr(start, cursor - start)));
+                    ++cursor; 
+                    return true;
+                }
+                std::string_view word = src.substr(start, cursor - start);
+                if (auto reg = ISA::getRegister(word)) tokens.push(Token::Register, start, word.size(), line, *reg);
+                else {
+                    int def = ISA::getDefIndex(word);
+                    tokens.push(Token::Mnemonic, start, word.size(), line, def >= 0 ? def : detail::symbolHash(word));
+                }
+                return true;
+            }
+
+            if (c == '+' || c == '-' || isClass(c, detail::CC_Digit)) { // Immediate
+                size_t start = cursor;
+                if (src[cursor] == '+' || src[cursor] == '-') ++cursor;
+                if (cursor + 1 < src.size() && src[cursor] == '0' && (src[cursor+1] == 'x' || src[cursor+1] == 'X')) {
+                    cursor += 2;
+                    while (cursor < src.size() && isClass(src[cursor], detail::CC_Hex)) ++cursor;
+                } else {
+                    while (cursor < src.size() && isClass(src[cursor], detail::CC_Digit)) ++cursor;
+                }
+                int32_t value = 0;
+                if (!detail::parseInteger(src.substr(start, cursor - start), value))
+                    throw std::runtime_error("Invalid immediate '" + std::string(src.substr(start, cursor - start)) + "' at line " + std::to_string(line));
+                tokens.push(Token::Immediate, start, cursor - start, line, value);
+                return true;
+            }
+            throw std::runtime_error("Unexpected character '" + std::string(1, c) + "' at line " + std::to_string(line));
+        }
+        return false;
+    }
+
+    template <typename Scan, typename Sink>
+    void tokenizeWith(Sink& tokens) {
+        while (lexOne<Scan>(tokens)) {}
+    }
+
+    template <typename Sink>
+    void dispatch(Path path, Sink& sink) {
+        if (path == Path::Auto) path = bestPath();
+        if (!supports(path)) throw std::runtime_error("Lexer path not supported on this CPU");
+        switch (path) {
+#if RV32_LEX_SIMD
+        case Path::AVX2:  tokenizeWith<detail::Avx2Scan>(sink); break;
+        case Path::SSE42: tokenizeWith<detail::Sse42Scan>(sink); break;
+#endif
+        default:          tokenizeWith<detail::ScalarScan>(sink); break;
+        }
+    }
+
+public:
+    // `firstLine` numbers diagnostics when `source` is a slice of a larger file.
+    constexpr Lexer(std::string_view source, size_t firstLine = 1) : src(source), line(firstLine) {}
+
+    // Pull interface: lexes one token per call and returns false at end of
+    // input. Nothing is buffered, so arbitrarily large sources stream in
+    // constant memory.
+    constexpr bool next(TokenStream::Ref& out) {
+        PullSink sink{src, out};
+#if defined(__cpp_lib_is_constant_evaluated)
+        if (std::is_constant_evaluated()) return lexOne<detail::ScalarScan>(sink); // no CPUID at compile time
+#endif
+        if (pullPath == Path::Auto) pullPath = bestPath();
+        switch (pullPath) {
+#if RV32_LEX_SIMD
+        case Path::AVX2:  return lexOne<detail::Avx2Scan>(sink);
+        case Path::SSE42: return lexOne<detail::Sse42Scan>(sink);
+#endif
+        default:          return lexOne<detail::ScalarScan>(sink);
+        }
+    }
+
+    // Line of the token most recently returned by next().
+    constexpr size_t currentLine() const { return line; }
+
+    static bool supports(Path p) {
+        switch (p) {
+        case Path::Auto:
+        case Path::Scalar: return true;
+#if RV32_LEX_SIMD
+        case Path::SSE42: return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+        case Path::AVX2:  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+#endif
+        default: return false;
+        }
+    }
+
+    // Widest scanner the running CPU supports (CPUID).
+    static Path bestPath() {
+        static const Path best = supports(Path::AVX2) ? Path::AVX2
+                               : supports(Path::SSE42) ? Path::SSE42 : Path::Scalar;
+        return best;
+    }
+
+    std::vector<Token> tokenize(Path path = Path::Auto) {
+        VectorSink sink{src, {}};
+        dispatch(path, sink);
+        return std::move(sink.tokens);
+    }
+
+    // Same tokens, packed; this is what the Assembler consumes.
+    TokenStream tokenizePacked(Path path = Path::Auto) {
+        TokenStream tokens;
+        tokenizePacked(tokens, path);
+        return tokens;
+    }
+
+    // Same, into an existing stream whose buffers are reused.
+    void tokenizePacked(TokenStream& into, Path path = Path::Auto) {
+        into.reset(src, line);
+        into.reserve(src.size() / 4); // assembly rarely exceeds 1 token per 4 bytes
+        StreamSink sink{into};
+        dispatch(path, sink);
+    }
+};
+
+// ============================================================================
+// 3. ASSEMBLER ENGINE
+// ============================================================================
+namespace detail {
+
+// Open-addressing label -> address map. Keys are views into the source and
+// come with the hash the lexer already computed, so defining or resolving a
+// label neither allocates nor rehashes. Linear probing over one flat array;
+// grows at 3/4 load.
+class SymbolTable {
+    struct Slot {
+        std::string_view name;
+        int32_t hash = 0; // 0 = empty; symbol hashes always have the top bit set
+        Address address = 0;
+    };
+    std::vector<Slot> slots;
+    size_t count = 0;
+
+    size_t probe(std::string_view name, int32_t hash) const {
+        const size_t mask = slots.size() - 1;
+        size_t i = static_cast<uint32_t>(hash) & mask;
+        while (slots[i].hash != 0 && (slots[i].hash != hash || slots[i].name != name)) i = (i + 1) & mask;
+        return i;
+    }
+
+    void rehash(size_t capacity) {
+        std::vector<Slot> old(capacity);
+        old.swap(slots);
+        for (const Slot& s : old)
+            if (s.hash != 0) slots[probe(s.name, s.hash)] = s;
+    }
+
+public:
+    size_t size() const { return count; }
+    // Keeps the slot array, so a reused table does not reallocate.
+    void clear() {
+        if (count) std::fill(slots.begin(), slots.end(), Slot{});
+        count = 0;
+    }
+    void reserve(size_t n) {
+        if (n * 4 > slots.size() * 3) rehash(ceilPow2(std::max<size_t>(16, n * 4 / 3 + 1)));
+    }
+
+    // False if `name` is already defined.
+    bool insert(std::string_view name, int32_t hash, Address address) {
+        reserve(count + 1);
+        Slot& s = slots[probe(name, hash)];
+        if (s.hash != 0) return false;
+        s = {name, hash, address};
+        ++count;
+        return true;
+    }
+
+    const Address* find(std::string_view name, int32_t hash) const {
+        if (slots.empty()) return nullptr;
+        const Slot& s = slots[probe(name, hash)];
+        return s.hash != 0 ? &s.address : nullptr;
+    }
+
+    // Removes `name` if present. Later members of its probe run shift back
+    // into the gap, so lookups never meet tombstones.
+    void erase(std::string_view name, int32_t hash) {
+        if (slots.empty()) return;
+        const size_t mask = slots.size() - 1;
+        size_t hole = probe(name, hash);
+        if (slots[hole].hash == 0) return;
+        slots[hole] = Slot{};
+        --count;
+        for (size_t j = (hole + 1) & mask; slots[j].hash != 0; j = (j + 1) & mask) {
+            const size_t home = static_cast<uint32_t>(slots[j].hash) & mask;
+            if (((j - home) & mask) >= ((j - hole) & mask)) { // the hole lies between home and j
+                slots[hole] = slots[j];
+                slots[j] = Slot{};
+                hole = j;
+            }
+        }
+    }
+
+    // Visits every symbol as fn(name, address), in no particular order.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const Slot& s : slots)
+            if (s.hash != 0) fn(s.name, s.address);
+    }
+};
+
+// Splits `src` into at most `parts` pieces of similar size, each ending just
+// after a newline (the last one at the end of the source).
+inline std::vector<std::string_view> splitAtLines(std::string_view src, size_t parts) {
+    std::vector<std::string_view> chunks;
+    size_t begin = 0;
+    for (size_t p = 1; p < parts && begin < src.size(); ++p) {
+        size_t cut = src.find('\n', std::max(begin, src.size() * p / parts));
+        if (cut == std::string_view::npos) break;
+        chunks.push_back(src.substr(begin, cut + 1 - begin));
+        begin = cut + 1;
+    }
+    if (begin < src.size() || chunks.empty()) chunks.push_back(src.substr(begin));
+    return chunks;
+}
+
+// Runs fn(0..n-1) on n threads and rethrows the failure with the lowest index,
+// so the reported error is the one the serial path would have hit first.
+template <typename Fn>
+void parallelFor(size_t n, Fn&& fn) {
+    std::vector<std::exception_ptr> errors(n);
+    std::vector<std::thread> pool;
+    pool.reserve(n);
+    for (size_t i = 1; i < n; ++i)
+        pool.emplace_back([&, i] { try { fn(i); } catch (...) { errors[i] = std::current_exception(); } });
+    try { fn(0); } catch (...) { errors[0] = std::current_exception(); }
+    for (auto& t : pool) t.join();
+    for (auto& e : errors)
+        if (e) std::rethrow_exception(e);
+}
+
+// Runs fn(worker, task) for every task in [0, tasks) on `workers` threads.
+// Each worker starts with a contiguous block, takes from the back of its own
+// deque and, once that is empty, steals from the front of the others, so a
+// few slow tasks do not leave the remaining threads idle. The first failure
+// is rethrown after all workers have stopped.
+template <typename Fn>
+void forEachStealing(size_t tasks, unsigned workers, Fn&& fn) {
+    workers = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(workers, tasks)));
+    struct Queue {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+    std::vector<Queue> queues(workers);
+    for (size_t t = 0; t < tasks; ++t) queues[t * workers / tasks].tasks.push_back(t);
+
+    auto claim = [&](unsigned self, size_t& task) {
+        {
+            std::lock_guard<std::mutex> g(queues[self].lock);
+            if (!queues[self].tasks.empty()) { task = queues[self].tasks.back(); queues[self].tasks.pop_back(); return true; }
+        }
+        for (unsigned k = 1; k < workers; ++k) {
+            Queue& victim = queues[(self + k) % workers];
+            std::lock_guard<std::mutex> g(victim.lock);
+            if (!victim.tasks.empty()) { task = victim.tasks.front(); victim.tasks.pop_front(); return true; }
+        }
+        return false; // nothing is ever re-queued, so empty everywhere means done
+    };
+    std::exception_ptr failure;
+    std::mutex failureLock;
+    auto work = [&](unsigned self) {
+        size_t task;
+        while (claim(self, task)) {
+            try { fn(self, task); } catch (...) {
+                std::lock_guard<std::mutex> g(failureLock);
+                if (!failure) failure = std::current_exception();
+            }
+        }
+    };
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < workers; ++w) pool.emplace_back(work, w);
+    work(0);
+    for (auto& t : pool) t.join();
+    if (failure) std::rethrow_exception(failure);
+}
+
+} // namespace detail
+
+// Forward-only token cursors the passes run over: one walks a lexed
+// TokenStream, the other pulls tokens straight from the Lexer.
+class StreamCursor {
+    const TokenStream& ts;
+    size_t pos = 0;
+
+public:
+    explicit StreamCursor(const TokenStream& t) : ts(t) {}
+    bool done() const { return pos >= ts.size(); }
+    Token::Kind peekKind() const { return ts.kind(pos); }
+    TokenStream::Ref peek() const { return ts[pos]; }
+    TokenStream::Ref take() { return ts[pos++]; }
+    // Cheap handle on the last token taken; only turned into a line number
+    // when a diagnostic needs it.
+    size_t mark() const { return pos - 1; }
+    size_t peekMark() const { return pos; }
+    size_t lineAt(size_t m) const { return ts.lineOf(m); }
+};
+
+class LexerCursor {
+    Lexer lexer;
+    TokenStream::Ref ahead{};
+    size_t aheadLine = 0, lastLine = 0;
+    bool has = false;
+
+    constexpr void advance() { has = lexer.next(ahead); aheadLine = lexer.currentLine(); }
+
+public:
+    explicit constexpr LexerCursor(std::string_view source) : lexer(source) { advance(); }
+    constexpr bool done() const { return !has; }
+    constexpr Token::Kind peekKind() const { return ahead.kind; }
+    constexpr TokenStream::Ref peek() const { return ahead; }
+    constexpr TokenStream::Ref take() { auto t = ahead; lastLine = aheadLine; advance(); return t; }
+    constexpr size_t mark() const { return lastLine; }
+    constexpr size_t peekMark() const { return aheadLine; }
+    constexpr size_t lineAt(size_t m) const { return m; }
+};
+
+// One assembly error. The passes collect these and keep going, so a single
+// run reports every bad line instead of stopping at the first.
+struct Diagnostic {
+    size_t line;
+    std::string message;
+};
+
+// A run of words placed at consecutive addresses from `base`, as handed to
+// the image writers.
+struct ImageSegment {
+    Address base;
+    const InstructionCode* words;
+    size_t count;
+};
+
+namespace detail {
+
+enum class Errc : uint8_t {
+    UnknownInstruction, UnexpectedEnd, ExpectedRegister, ExpectedImmediate,
+    ExpectedComma, ExpectedLParen, ExpectedRParen,
+    UndefinedLabel, OddBranchOffset, OddJumpOffset, OutOfRange, DuplicateLabel,
+};
+
+// Errors in an operand's value rather than in the statement's shape. The
+// statement was read in full and keeps its length; any other error costs
+// one placeholder word and the rest of the line.
+constexpr bool isValueError(Errc code) {
+    return code == Errc::UndefinedLabel || code == Errc::OddBranchOffset || code == Errc::OddJumpOffset ||
+           code == Errc::OutOfRange;
+}
+
+// The tokens pass 2 reads after a mnemonic taking `operands`, in order: 'r' a register,
+// 'i' an immediate, ',' '(' ')' themselves, and 'l' a label operand,
+// which takes whatever token comes next.
+constexpr std::string_view operandShape(Operands operands) {
+    switch (operands) {
+    case Operands::None:        return "";
+    case Operands::RdRs1Rs2:    return "r,r,r";  // rd , rs1 , rs2
+    case Operands::RdRs1Imm:    return "r,r,i";  // rd , rs1 , imm
+    case Operands::RdRs1Shamt:  return "r,r,i";  // rd , rs1 , shamt
+    case Operands::RdMem:       return "r,i(r)"; // rd , off ( rs1 )
+    case Operands::Rs2Mem:      return "r,i(r)"; // rs2 , off ( rs1 )
+    case Operands::Rs1Rs2Label: return "r,r,l";  // rs1 , rs2 , label
+    case Operands::RdImm:       return "r,i";    // rd , imm
+    case Operands::RdLabel:     return "r,l";    // rd , label
+    case Operands::RdRs1:       return "r,r";    // rd , rs
+    case Operands::RdRs2:       return "r,r";    // rd , rs
+    case Operands::Rs1:         return "r";      // rs
+    case Operands::Rs1Label:    return "r,l";    // rs , label
+    case Operands::Rs2Label:    return "r,l";    // rs , label
+    case Operands::Rs2Rs1Label: return "r,r,l";  // rs , rt , label
+    case Operands::Label:       return "l";      // label
+    case Operands::RdValue:     return "r,i";    // rd , imm
+    case Operands::Rs2LabelRs1: return "r,l,r";  // rs , label , rt
+    }
+    return "";
+}
+
+// operandShape() as a mask of the Token::Kinds each position accepts, so
+// layout() checks a token with one shift.
+struct OperandShape {
+    std::array<uint16_t, 6> accepts{};
+    uint8_t count = 0;
+};
+
+inline constexpr auto kOperandShapes = [] {
+    std::array<OperandShape, static_cast<size_t>(Operands::Rs2LabelRs1) + 1> t{};
+    for (size_t o = 0; o < t.size(); ++o) {
+        const std::string_view shape = operandShape(static_cast<Operands>(o));
+        t[o].count = static_cast<uint8_t>(shape.size());
+        for (size_t k = 0; k < shape.size(); ++k) {
+            switch (shape[k]) {
+            case 'r': t[o].accepts[k] = 1u << Token::Register; break;
+            case 'i': t[o].accepts[k] = 1u << Token::Immediate; break;
+            case ',': t[o].accepts[k] = 1u << Token::Comma; break;
+            case '(': t[o].accepts[k] = 1u << Token::LParen; break;
+            case ')': t[o].accepts[k] = 1u << Token::RParen; break;
+            default:  t[o].accepts[k] = 0xFFFFu; break; // 'l'
+            }
+        }
+    }
+    return t;
+}();
+
+// A mnemonic's second syntax: the ISA row keyed "<mnemonic> <operands>".
+// Both read the same tokens up to position `at`; the statement takes the
+// second one if the token there is a kind `accepts` has, or if the input
+// ends there and `atEnd`. A label operand is taken to be a symbol word
+// there, and the end of a shape to be where the next statement starts.
+struct Overload {
+    int index = -1;
+    uint8_t at = 0;
+    uint16_t accepts = 0;
+    bool atEnd = false;
+};
+
+inline constexpr auto kOverloads = [] {
+    std::array<Overload, ISA::defCount()> t{};
+    for (int i = 0; i < ISA::defCount(); ++i) {
+        const std::string_view name = ISA::nameAt(i);
+        for (int j = 0; j < ISA::defCount(); ++j) {
+            const std::string_view key = ISA::nameAt(j);
+            if (key.size() <= name.size() || key[name.size()] != ' ' || key.substr(0, name.size()) != name) continue;
+            const std::string_view first = operandShape(ISA::defAt(i).operands), second = operandShape(ISA::defAt(j).operands);
+            size_t at = 0;
+            while (at < first.size() && at < second.size() && first[at] == second[at]) ++at;
+            Overload& o = t[static_cast<size_t>(i)];
+            o.index = j;
+            o.at = static_cast<uint8_t>(at);
+            if (at == second.size()) {
+                o.accepts = 1u << Token::Mnemonic | 1u << Token::Label | 1u << Token::Directive;
+                o.atEnd = true;
+            } else if (second[at] == 'l') {
+                o.accepts = 1u << Token::Mnemonic;
+            } else {
+                o.accepts = kOperandShapes[static_cast<size_t>(ISA::defAt(j).operands)].accepts[at];
+            }
+        }
+    }
+    return t;
+}();
+
+// Whether the statement at `cur`, now at position o.at, takes the second syntax.
+template <typename Cursor>
+constexpr bool takesOverload(const Overload& o, const Cursor& cur) {
+    return o.index >= 0 && (cur.done() ? o.atEnd : ((o.accepts >> cur.peekKind()) & 1u) != 0);
+}
+
+// An error as the hot path sees it: a code, the offending token text and a
+// cursor mark. The message is only built when it becomes a Diagnostic.
+struct Error {
+    Errc code;
+    std::string_view text;
+    size_t where;
+    int words = 0; // a value error's statement still takes this many words
+};
+
+// The words one statement assembles to: one, or a pseudo-instruction's sequence.
+struct Encoded {
+    std::array<InstructionCode, ISA::kMaxWords> words{};
+    int count = 0;
+};
+
+// Value-or-Error result (std::expected is C++23).
+template <typename T>
+class Expected {
+    T val{};
+    Error err{};
+    bool ok = true;
+
+public:
+    constexpr Expected(T v) : val(v) {}
+    constexpr Expected(Error e) : err(e), ok(false) {}
+    constexpr explicit operator bool() const { return ok; }
+    constexpr const T& operator*() const { return val; }
+    constexpr const Error& error() const { return err; }
+};
+
+} // namespace detail
+
+// Bump whenever the encoder's output changes for some input; together with
+// ISA::fingerprint() it versions cached images.
+inline constexpr uint32_t kEncoderRevision = 4;
+
+class Assembler {
+    friend class IncrementalAssembler; // encodes single lines against this symbol table
+    friend class ConstAssembler;       // runs layout() and encodeWith() in constant expressions
+
+    TokenStream tokens;
+    detail::SymbolTable symbolTable; // names point into the source, which must outlive the pass
+    std::vector<InstructionCode> binaryOutput;
+    std::vector<Diagnostic> diags;
+    std::vector<Diagnostic> labelDiags; // duplicate labels, merged into diags when a run ends
+
+    // Sparse placement of binaryOutput: a new segment starts at every .org,
+    // so an address gap costs one entry, never zero fill.
+    struct Segment {
+        Address base;
+        size_t first;     // index into binaryOutput
+        size_t words;
+        size_t where = 0; // cursor mark of the first instruction, for diagnostics
+        size_t chunk = 0; // which chunk's TokenStream `where` refers to (parallel mode)
+    };
+    std::vector<Segment> segments;
+
+    static std::string hexAddress(Address a) {
+        std::string s = "0x00000000";
+        for (int i = 0; i < 8; ++i) s[2 + i] = "0123456789abcdef"[(a >> (28 - 4 * i)) & 0xF];
+        return s;
+    }
+
+    // Reports every segment that lands on addresses an earlier one already
+    // holds. lineOf(segment) locates it for the message. In-order, disjoint
+    // placement (the usual case) is confirmed in one scan with no allocation.
+    template <typename LineOf>
+    void checkOverlaps(const std::vector<Segment>& segs, LineOf&& lineOf) {
+        auto end = [](const Segment& seg) { return uint64_t(seg.base) + 4 * uint64_t(seg.words); };
+        uint64_t reach = 0;
+        bool ordered = true;
+        for (const Segment& seg : segs) {
+            if (seg.words == 0) continue;
+            if (seg.base < reach) { ordered = false; break; }
+            reach = end(seg);
+        }
+        if (ordered) return;
+
+        std::vector<size_t> order;
+        for (size_t i = 0; i < segs.size(); ++i)
+            if (segs[i].words) order.push_back(i);
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return segs[a].base < segs[b].base; });
+        size_t holder = order.front(); // reaches furthest among those seen so far
+        for (size_t k = 1; k < order.size(); ++k) {
+            const size_t i = order[k];
+            if (segs[i].base < end(segs[holder])) {
+                const Segment& later = segs[std::max(i, holder)];
+                const Segment& earlier = segs[std::min(i, holder)];
+                diags.push_back({lineOf(later), "Segment at " + hexAddress(later.base) + " collides with line " +
+                                                std::to_string(lineOf(earlier)) + "'s segment at " + hexAddress(earlier.base)});
+            }
+            if (end(segs[i]) > end(segs[holder])) holder = i;
+        }
+    }
+
+    // Orders diags by line once a run is done: pass 2's errors and the
+    // overlap check after it are each in order, but one follows the other.
+    // Duplicate labels are kept apart and go first on their line, whether
+    // pass 1 or one-pass mode found them.
+    void sortDiagnostics() {
+        auto byLine = [](const Diagnostic& a, const Diagnostic& b) { return a.line < b.line; };
+        std::stable_sort(diags.begin(), diags.end(), byLine);
+        if (labelDiags.empty()) return;
+        std::vector<Diagnostic> merged;
+        merged.reserve(labelDiags.size() + diags.size());
+        std::merge(std::make_move_iterator(labelDiags.begin()), std::make_move_iterator(labelDiags.end()),
+                   std::make_move_iterator(diags.begin()), std::make_move_iterator(diags.end()), std::back_inserter(merged), byLine);
+        diags.swap(merged);
+        labelDiags.clear();
+    }
+
+    // A label operand naming a label that was not defined yet when the
+    // instruction was encoded (one-pass mode only).
+    struct Fixup {
+        size_t word;            // index into binaryOutput of the instruction's first word
+        Address pc;             // address of the instruction
+        std::string_view label; // points into the source
+        int32_t hash;           // detail::symbolHash(label)
+        size_t where;           // cursor mark of the instruction, for diagnostics
+        InstrType type;         // labelKind() of the instruction
+        size_t diag;            // diags.size() when recorded: where two-pass reports its error
+    };
+    std::vector<Fixup> fixups;
+
+    static std::string describe(const detail::Error& e) {
+        using detail::Errc;
+        const std::string got = e.text.empty() ? " before end of line" : ", got '" + std::string(e.text) + "'";
+        switch (e.code) {
+        case Errc::UnknownInstruction: return "Unknown instruction: " + std::string(e.text);
+        case Errc::UnexpectedEnd:      return "Unexpected end of tokens";
+        case Errc::ExpectedRegister:   return "Expected register" + got;
+        case Errc::ExpectedImmediate:  return "Expected immediate" + got;
+        case Errc::ExpectedComma:      return "Expected ','" + got;
+        case Errc::ExpectedLParen:     return "Expected '('" + got;
+        case Errc::ExpectedRParen:     return "Expected ')'" + got;
+        case Errc::UndefinedLabel:     return "Undefined label: " + std::string(e.text);
+        case Errc::OddBranchOffset:    return "Branch offset must be even";
+        case Errc::OddJumpOffset:      return "Jump offset must be even";
+        case Errc::OutOfRange:         return "Value does not fit its field: " + std::string(e.text);
+        case Errc::DuplicateLabel:     return "Duplicate label: " + std::string(e.text);
+        }
+        return "Unknown error";
+    }
+
+    template <typename Cursor>
+    static void report(const detail::Error& e, const Cursor& cur, std::vector<Diagnostic>& out) {
+        out.push_back({cur.lineAt(e.where), describe(e)});
+    }
+
+    // Error recovery: drops what is left of the line holding mark `where`.
+    template <typename Cursor>
+    static constexpr void skipLine(Cursor& cur, size_t where) {
+        const size_t line = cur.lineAt(where);
+        while (!cur.done() && cur.lineAt(cur.peekMark()) == line) cur.take();
+    }
+
+    // Number of tokens after the mnemonic that pass 2 consumes, separators included.
+    static constexpr int operandTokens(int defIndex) {
+        return detail::kOperandShapes[static_cast<size_t>(ISA::defAt(defIndex).operands)].count;
+    }
+
+    // How the label operand of `def` is encoded: the offset of one B- or
+    // J-type word, or (U_TYPE) split across the auipc pair of a sequence.
+    // R_TYPE when it takes no label.
+    static constexpr InstrType labelKind(const InstructionDef& def) {
+        switch (def.operands) {
+        case Operands::Rs1Rs2Label:
+        case Operands::Rs1Label:
+        case Operands::Rs2Label:
+        case Operands::Rs2Rs1Label: return InstrType::B_TYPE;
+        case Operands::RdLabel:
+        case Operands::Label:       return ISA::isSequence(def) ? InstrType::U_TYPE : InstrType::J_TYPE;
+        case Operands::Rs2LabelRs1: return InstrType::U_TYPE;
+        default:                    return InstrType::R_TYPE;
+        }
+    }
+
+    template <typename Cursor>
+    void defineLabel(std::string_view name, int32_t hash, Address pc, const Cursor& cur, size_t where) {
+        if (!symbolTable.insert(name, hash, pc)) report({detail::Errc::DuplicateLabel, name, where}, cur, labelDiags);
+    }
+
+    // What pass 1 learned about a run of tokens. Until the first .org the
+    // addresses are relative to wherever the run starts.
+    struct Layout {
+        Address endPC = 0;
+        bool absolute = false; // an .org was seen; endPC is absolute
+        bool complete = true;  // the last statement did not run off the end
+        size_t words = 0;      // instructions emitted
+        size_t origins = 0;    // .org directives seen
+    };
+
+    // Pass 1 proper: lays out addresses from `startPC` and reports every label
+    // through define(name, hash, pc, absolute, mark).
+    template <typename Cursor, typename Define>
+    static constexpr Layout layout(Cursor& cur, Address startPC, Define&& define) {
+        Layout lay;
+        Address pc = startPC;
+        while (!cur.done()) {
+            const auto tk = cur.take();
+            if (tk.kind == Token::Label) {
+                define(tk.text, tk.value, pc, lay.absolute, cur.mark());
+            } else if (tk.kind == Token::Mnemonic) {
+                // Skip operands, consuming exactly what pass 2 will: it stops
+                // at the first token of the wrong kind, emits one placeholder
+                // word and drops the rest of the line, and so does this. Label
+                // operands (also Mnemonic tokens) are thus never counted as
+                // instructions. li's immediate decides its length. Where a
+                // mnemonic's second syntax (detail::kOverloads) parts from
+                // the first, the token there picks one, as in encodeWith().
+                const size_t where = cur.mark();
+                int words = 1;
+                bool malformed = tk.value < 0;
+                if (!malformed) {
+                    int index = tk.value;
+                    const detail::Overload& other = detail::kOverloads[static_cast<size_t>(index)];
+                    const detail::OperandShape* shape = &detail::kOperandShapes[static_cast<size_t>(ISA::defAt(index).operands)];
+                    int32_t value = 0;
+                    for (size_t k = 0; k < shape->count; ++k) {
+                        if (k == other.at && detail::takesOverload(other, cur)) {
+                            if (cur.done()) lay.complete = false; // the first syntax may go on past the end
+                            index = other.index;
+                            shape = &detail::kOperandShapes[static_cast<size_t>(ISA::defAt(index).operands)];
+                            if (k == shape->count) break;
+                        }
+                        if (cur.done()) {
+                            lay.complete = false;
+                            malformed = true;
+                            break;
+                        }
+                        if (!((shape->accepts[k] >> cur.peekKind()) & 1u)) {
+                            malformed = true;
+                            break;
+                        }
+                        if (const auto op = cur.take(); op.kind == Token::Immediate) value = op.value;
+                    }
+                    if (!malformed) words = ISA::length(index, value);
+                }
+                if (malformed) skipLine(cur, where);
+                pc += 4 * static_cast<Address>(words);
+                lay.words += static_cast<size_t>(words);
+            } else if (tk.kind == Token::Directive && tk.text == ".org") {
+                if (!cur.done() && cur.peekKind() == Token::Immediate) {
+                    pc = static_cast<Address>(cur.take().value);
+                    lay.absolute = true;
+                    ++lay.origins;
+                } else if (cur.done()) {
+                    lay.complete = false;
+                }
+            }
+        }
+        lay.endPC = pc;
+        return lay;
+    }
+
+    template <typename Cursor>
+    Layout runPass1(Cursor& cur) {
+        diags.clear();
+        labelDiags.clear();
+        symbolTable.clear();
+        return layout(cur, 0, [&](std::string_view name, int32_t hash, Address pc, bool, size_t where) {
+            defineLabel(name, hash, pc, cur, where);
+        });
+    }
+
+    // Encodes the instruction whose mnemonic `tk` (at cursor mark `where`)
+    // was just taken, reading its operands from `cur`. Nothing here allocates
+    // or throws; errors come back in the result.
+    template <bool OnePass, typename Cursor>
+    detail::Expected<detail::Encoded> encode(const TokenStream::Ref& tk, Cursor& cur, size_t where, Address pc, size_t emitted) {
+        const size_t pending = fixups.size();
+        auto enc = encodeWith(tk, cur, where, [&](std::string_view label, int32_t hash, InstrType type) -> std::optional<int32_t> {
+            if (const Address* addr = symbolTable.find(label, hash)) return static_cast<int32_t>(*addr - pc);
+            if constexpr (OnePass) {
+                fixups.push_back({emitted, pc, label, hash, where, type, diags.size()});
+                return 0;
+            } else {
+                return std::nullopt;
+            }
+        });
+        // A statement in error emits placeholders and reports its first
+        // error only, so a label read before an operand that failed is moot.
+        if (OnePass && !enc) fixups.resize(pending);
+        return enc;
+    }
+
+    // The body of encode(), with label operands resolved by
+    // resolve(name, hash, type): the PC-relative offset, or nullopt for an
+    // undefined label. Usable in constant expressions (ConstAssembler).
+    template <typename Cursor, typename Resolve>
+    static constexpr detail::Expected<detail::Encoded> encodeWith(const TokenStream::Ref& tk, Cursor& cur, size_t where, Resolve&& resolve) {
+        using detail::Errc;
+        if (tk.value < 0) return detail::Error{Errc::UnknownInstruction, tk.text, where};
+        const InstructionDef& def = ISA::defAt(tk.value);
+
+        // Operand readers. The first failure is kept and every later read
+        // returns a dummy without consuming, so the encoding below stays
+        // straight-line and the error surfaces once, at the end. A token of
+        // the wrong kind is left in place: it usually starts the next line,
+        // which recovery then assembles normally. A value that is wrong
+        // (detail::isValueError) is only noted, and reading goes on.
+        std::optional<detail::Error> failure, invalid;
+        auto fail = [&](Errc code, std::string_view text, size_t mark) {
+            if (!failure) failure = detail::Error{code, text, mark};
+        };
+        auto reject = [&](Errc code, std::string_view text) {
+            if (!invalid) invalid = detail::Error{code, text, where};
+        };
+        auto next = [&]() -> TokenStream::Ref {
+            if (failure) return {};
+            if (cur.done()) { fail(Errc::UnexpectedEnd, {}, where); return {}; }
+            return cur.take();
+        };
+        auto take = [&](Token::Kind kind, Errc mismatch) -> TokenStream::Ref {
+            if (failure) return {};
+            if (cur.done()) { fail(Errc::UnexpectedEnd, {}, where); return {}; }
+            if (cur.peekKind() != kind) {
+                // A token on a later line means this one stopped short.
+                if (cur.lineAt(cur.peekMark()) != cur.lineAt(where)) fail(mismatch, {}, where);
+                else fail(mismatch, cur.peek().text, cur.peekMark());
+                return {};
+            }
+            return cur.take();
+        };
+        auto comma  = [&] { take(Token::Comma, Errc::ExpectedComma); };
+        auto lparen = [&] { take(Token::LParen, Errc::ExpectedLParen); };
+        auto rparen = [&] { take(Token::RParen, Errc::ExpectedRParen); };
+        // The lexer already resolved registers and immediates.
+        auto reg = [&]() -> uint8_t { return static_cast<uint8_t>(take(Token::Register, Errc::ExpectedRegister).value); };
+        auto immediate = [&]() -> int32_t { return take(Token::Immediate, Errc::ExpectedImmediate).value; };
+        // An immediate its field holds only within [lo, hi]; never masked.
+        auto bounded = [&](int32_t lo, int32_t hi) -> int32_t {
+            const auto value = take(Token::Immediate, Errc::ExpectedImmediate);
+            if (!failure && (value.value < lo || value.value > hi)) reject(Errc::OutOfRange, value.text);
+            return value.value;
+        };
+        // PC-relative offset to a label operand.
+        auto target = [&](InstrType type) -> int32_t {
+            const auto label = next();
+            if (failure) return 0;
+            // Labels that spell a register or mnemonic were lexed as such; hash them here.
+            const int32_t hash = label.kind == Token::Mnemonic && label.value < 0 ? label.value : detail::symbolHash(label.text);
+            const std::optional<int32_t> offset = resolve(label.text, hash, type);
+            if (!offset) {
+                reject(Errc::UndefinedLabel, label.text);
+                return 0;
+            }
+            if (type != InstrType::U_TYPE && *offset % 2 != 0)
+                reject(type == InstrType::B_TYPE ? Errc::OddBranchOffset : Errc::OddJumpOffset, {});
+            else if (!ISA::reaches(type, *offset))
+                reject(Errc::OutOfRange, label.text);
+            return *offset;
+        };
+
+        // A mnemonic with a second syntax (detail::kOverloads) switches to it
+        // where the two part, as layout() does; `index` is the row read.
+        int index = tk.value;
+        const detail::Overload& other = detail::kOverloads[static_cast<size_t>(index)];
+        auto forks = [&] {
+            if (failure || !detail::takesOverload(other, cur)) return false;
+            index = other.index;
+            return true;
+        };
+
+        // --- OPERANDS ---
+        // Read in source order; the ISA table says which word fields they
+        // fill, and which registers a pseudo-instruction implies.
+        uint8_t rd = def.impliedRd, rs1 = def.impliedRs1, rs2 = 0;
+        int32_t imm = 0;
+        switch (def.operands) {
+        case Operands::None: break;
+        case Operands::RdRs1Rs2:
+            rd = reg(); comma(); rs1 = reg(); comma(); rs2 = reg();
+            break;
+        case Operands::RdRs1Imm:
+            rd = reg();
+            if (forks()) { // jalr rs
+                rs1 = rd;
+                rd = ISA::defAt(index).impliedRd;
+                break;
+            }
+            comma(); rs1 = reg(); comma(); imm = bounded(-2048, 2047);
+            break;
+        case Operands::RdRs1Shamt:
+            rd = reg(); comma(); rs1 = reg(); comma(); imm = bounded(0, 31);
+            break;
+        case Operands::RdMem:
+            rd = reg(); comma();
+            if (forks()) { // lw rd, sym
+                imm = target(InstrType::U_TYPE);
+                rs1 = rd;
+                break;
+            }
+            imm = bounded(-2048, 2047); lparen(); rs1 = reg(); rparen();
+            break;
+        case Operands::Rs2Mem:
+            rs2 = reg(); comma();
+            if (forks()) { // sw rs, sym, rt
+                imm = target(InstrType::U_TYPE); comma(); rs1 = reg();
+                break;
+            }
+            imm = bounded(-2048, 2047); lparen(); rs1 = reg(); rparen();
+            break;
+        case Operands::Rs1Rs2Label:
+            rs1 = reg(); comma(); rs2 = reg(); comma(); imm = target(InstrType::B_TYPE);
+            break;
+        case Operands::RdImm:
+            rd = reg(); comma(); imm = static_cast<int32_t>(static_cast<uint32_t>(bounded(0, 0xFFFFF)) << 12);
+            break;
+        case Operands::RdLabel:
+            if (forks()) { // jal label
+                rd = ISA::defAt(index).impliedRd;
+                imm = target(InstrType::J_TYPE);
+                break;
+            }
+            rd = reg(); comma(); imm = target(labelKind(def));
+            rs1 = rd; // la: the auipc writes rd too
+            break;
+        case Operands::RdRs1:
+            rd = reg(); comma(); rs1 = reg();
+            break;
+        case Operands::RdRs2:
+            rd = reg(); comma(); rs2 = reg();
+            break;
+        case Operands::Rs1:
+            rs1 = reg();
+            break;
+        case Operands::Rs1Label:
+            rs1 = reg(); comma(); imm = target(InstrType::B_TYPE);
+            break;
+        case Operands::Rs2Label:
+            rs2 = reg(); comma(); imm = target(InstrType::B_TYPE);
+            break;
+        case Operands::Rs2Rs1Label:
+            rs2 = reg(); comma(); rs1 = reg(); comma(); imm = target(InstrType::B_TYPE);
+            break;
+        case Operands::Label:
+            imm = target(labelKind(def));
+            break;
+        case Operands::RdValue:
+            rd = reg(); comma(); imm = immediate();
+            break;
+        case Operands::Rs2LabelRs1:
+            rs2 = reg(); comma(); imm = target(InstrType::U_TYPE); comma(); rs1 = reg();
+            break;
+        }
+        detail::Encoded out;
+        out.count = ISA::expand(index, rd, rs1, rs2, imm, out.words.data());
+
+        if (failure) return *failure;
+        if (invalid) {
+            invalid->words = out.count;
+            return *invalid;
+        }
+        return out;
+    }
+
+    // Pass 2 proper. With OnePass, labels are defined as they are reached and
+    // references to labels not seen yet are encoded as 0 and recorded in
+    // `fixups` for applyFixups().
+    // Only reads shared state unless OnePass, so disjoint runs may encode
+    // concurrently; errors go to `out` and placement to `segs`.
+    template <bool OnePass, typename Cursor, typename Emit>
+    void runPass2(Cursor& cur, Emit&& emit, std::vector<Diagnostic>& out, std::vector<Segment>& segs, Address startPC = 0) {
+        Address currentPC = startPC;
+        size_t emitted = 0;
+        segs.push_back({currentPC, 0, 0});
+        while (!cur.done()) {
+            const auto tk = cur.take();
+            if (tk.kind == Token::Label) {
+                if constexpr (OnePass) defineLabel(tk.text, tk.value, currentPC, cur, cur.mark());
+                continue;
+            }
+            if (tk.kind == Token::Directive) {
+                if (tk.text == ".org") {
+                    if (!cur.done() && cur.peekKind() == Token::Immediate) {
+                        currentPC = static_cast<Address>(cur.take().value);
+                        segs.push_back({currentPC, emitted, 0});
+                    }
+                }
+                continue;
+            }
+            if (tk.kind != Token::Mnemonic) continue;
+
+            const size_t where = cur.mark();
+            const auto enc = encode<OnePass>(tk, cur, where, currentPC, emitted);
+            int words = enc ? (*enc).count : 1;
+            if (!enc) {
+                // Placeholders keep later addresses and fixup indices in step
+                // with layout(), which recovers the same way.
+                report(enc.error(), cur, out);
+                if (detail::isValueError(enc.error().code)) words = enc.error().words;
+                else skipLine(cur, where);
+            }
+            for (int k = 0; k < words; ++k) emit(enc ? (*enc).words[k] : 0);
+            emitted += static_cast<size_t>(words);
+            if (segs.back().words == 0) segs.back().where = where;
+            segs.back().words += static_cast<size_t>(words);
+            currentPC += 4 * static_cast<Address>(words);
+        }
+    }
+
+    // Patches every recorded forward reference now that all labels are known.
+    // Errors are slotted in where pass 2 of a two-pass run reports them, so
+    // both modes list the same diagnostics in the same order.
+    template <typename Cursor>
+    void applyFixups(const Cursor& cur) {
+        std::vector<Diagnostic> late;
+        std::vector<size_t> at;
+        auto reject = [&](const Fixup& f, detail::Errc code, std::string_view text) {
+            report({code, text, f.where}, cur, late);
+            at.push_back(f.diag);
+        };
+        for (const Fixup& f : fixups) {
+            const Address* addr = symbolTable.find(f.label, f.hash);
+            if (!addr) { reject(f, detail::Errc::UndefinedLabel, f.label); continue; }
+            int32_t offset = static_cast<int32_t>(*addr - f.pc);
+            if (f.type != InstrType::U_TYPE && offset % 2 != 0) {
+                reject(f, f.type == InstrType::B_TYPE ? detail::Errc::OddBranchOffset : detail::Errc::OddJumpOffset, {});
+                continue;
+            }
+            if (!ISA::reaches(f.type, offset)) {
+                reject(f, detail::Errc::OutOfRange, f.label);
+                continue;
+            }
+            ISA::retarget(&binaryOutput[f.word], f.type, offset);
+        }
+        fixups.clear();
+        if (late.empty()) return;
+
+        std::vector<Diagnostic> merged;
+        merged.reserve(diags.size() + late.size());
+        for (size_t i = 0, k = 0; i <= diags.size(); ++i) {
+            while (k < late.size() && at[k] == i) merged.push_back(std::move(late[k++]));
+            if (i < diags.size()) merged.push_back(std::move(diags[i]));
+        }
+        diags.swap(merged);
+    }
+
+    template <typename Cursor>
+    void runOnePass(Cursor& cur) {
+        binaryOutput.clear();
+        fixups.clear();
+        diags.clear();
+        labelDiags.clear();
+        symbolTable.clear();
+        segments.clear();
+        runPass2<true>(cur, [this](InstructionCode word) { binaryOutput.push_back(word); }, diags, segments);
+        applyFixups(cur);
+        checkOverlaps(segments, [&](const Segment& seg) { return cur.lineAt(seg.where); });
+        sortDiagnostics();
+    }
+
+public:
+    Assembler() = default;
+    Assembler(TokenStream t) : tokens(std::move(t)) {}
+
+    // Lexes `source` and runs both passes. Every buffer (tokens, symbol
+    // table, output, segments) is reused from the previous run, so one
+    // Assembler per thread serves any number of inputs.
+    void assemble(std::string_view source) {
+        Lexer(source).tokenizePacked(tokens);
+        pass1();
+        pass2();
+    }
+
+    // --- PASS 1: SYMBOL RESOLUTION ---
+    // Also sizes the output buffer, so pass 2 runs without allocating.
+    void pass1() {
+        StreamCursor cur(tokens);
+        const Layout lay = runPass1(cur);
+        binaryOutput.clear();
+        binaryOutput.reserve(lay.words);
+        segments.clear();
+        segments.reserve(lay.origins + 1);
+    }
+
+    // --- PASS 2: BINARY GENERATION ---
+    void pass2() {
+        binaryOutput.clear();
+        StreamCursor cur(tokens);
+        segments.clear();
+        runPass2<false>(cur, [this](InstructionCode word) { binaryOutput.push_back(word); }, diags, segments);
+        checkOverlaps(segments, [&](const Segment& seg) { return cur.lineAt(seg.where); });
+        sortDiagnostics();
+    }
+
+    // --- STREAMING MODE ---
+    // Both passes re-lex `source` on the fly and pass 2 hands each word to
+    // `emit` instead of storing it, so the only state that grows with the
+    // input is the symbol table.
+    void pass1Streaming(std::string_view source) {
+        LexerCursor cur(source);
+        runPass1(cur);
+    }
+
+    template <typename Emit>
+    void pass2Streaming(std::string_view source, Emit&& emit) {
+        LexerCursor cur(source);
+        std::vector<Segment> placement;
+        runPass2<false>(cur, emit, diags, placement);
+        checkOverlaps(placement, [&](const Segment& seg) { return cur.lineAt(seg.where); });
+        sortDiagnostics();
+    }
+
+    // --- ONE-PASS MODE ---
+    // Encodes every instruction as it is read; forward branch/jump targets are
+    // backpatched at the end. Output is bit-identical to pass1() + pass2(),
+    // and the diagnostics are the same, in the same order.
+    void assembleOnePass() {
+        StreamCursor cur(tokens);
+        runOnePass(cur);
+    }
+
+    // --- PARALLEL MODE ---
+    // Splits the source at line boundaries into up to `jobs` chunks, lexes and
+    // lays them out concurrently, places each chunk with a prefix sum over the
+    // per-chunk layouts (honouring .org), merges the label maps in source
+    // order and encodes every chunk into its own slice of binaryOutput.
+    // Output and diagnostics match pass1() + pass2(). A chunk boundary that
+    // falls inside a statement spanning lines falls back to the serial path.
+    void assembleParallel(std::string_view source, unsigned jobs) {
+        std::vector<std::string_view> chunks = detail::splitAtLines(source, jobs);
+        const size_t n = chunks.size();
+        auto serial = [&] {
+            Lexer(source).tokenizePacked(tokens);
+            pass1();
+            pass2();
+        };
+        if (n <= 1) return serial();
+
+        std::vector<size_t> firstLine(n, 1);
+        detail::parallelFor(n, [&](size_t i) {
+            if (i + 1 < n) firstLine[i + 1] = static_cast<size_t>(std::count(chunks[i].begin(), chunks[i].end(), '\n'));
+        });
+        for (size_t i = 1; i < n; ++i) firstLine[i] += firstLine[i - 1];
+
+        struct ChunkLabel { std::string_view name; int32_t hash; Address pc; bool absolute; size_t where; };
+        std::vector<TokenStream> streams(n);
+        std::vector<std::vector<ChunkLabel>> labels(n);
+        std::vector<Layout> layouts(n);
+        detail::parallelFor(n, [&](size_t i) {
+            streams[i] = Lexer(chunks[i], firstLine[i]).tokenizePacked();
+            StreamCursor cur(streams[i]);
+            layouts[i] = layout(cur, 0, [&](std::string_view name, int32_t hash, Address pc, bool absolute, size_t where) {
+                labels[i].push_back({name, hash, pc, absolute, where});
+            });
+        });
+        for (size_t i = 0; i + 1 < n; ++i)
+            if (!layouts[i].complete) return serial();
+
+        std::vector<Address> startPC(n);
+        std::vector<size_t> wordBase(n);
+        Address pc = 0;
+        size_t words = 0;
+        for (size_t i = 0; i < n; ++i) {
+            startPC[i] = pc;
+            wordBase[i] = words;
+            pc = layouts[i].absolute ? layouts[i].endPC : pc + layouts[i].endPC;
+            words += layouts[i].words;
+        }
+
+        symbolTable.clear();
+        diags.clear();
+        labelDiags.clear();
+        size_t labelCount = 0;
+        for (const auto& l : labels) labelCount += l.size();
+        symbolTable.reserve(labelCount);
+        for (size_t i = 0; i < n; ++i) {
+            StreamCursor cur(streams[i]);
+            for (const ChunkLabel& l : labels[i])
+                defineLabel(l.name, l.hash, l.absolute ? l.pc : startPC[i] + l.pc, cur, l.where);
+        }
+
+        binaryOutput.assign(words, 0);
+        std::vector<std::vector<Diagnostic>> chunkDiags(n);
+        std::vector<std::vector<Segment>> chunkSegs(n);
+        detail::parallelFor(n, [&](size_t i) {
+            StreamCursor cur(streams[i]);
+            InstructionCode* out = binaryOutput.data() + wordBase[i];
+            InstructionCode* const end = out + layouts[i].words; // layout() recovers from errors as runPass2 does; never overrun
+            runPass2<false>(cur, [&](InstructionCode word) { if (out != end) *out++ = word; }, chunkDiags[i], chunkSegs[i], startPC[i]);
+        });
+        for (auto& d : chunkDiags) diags.insert(diags.end(), std::make_move_iterator(d.begin()), std::make_move_iterator(d.end()));
+        // A chunk's first segment continues the one before it, as in a serial
+        // run; only an .org starts another.
+        segments.clear();
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t k = 0; k < chunkSegs[i].size(); ++k) {
+                const Segment& seg = chunkSegs[i][k];
+                if (k == 0 && i > 0) {
+                    Segment& open = segments.back();
+                    if (open.words == 0) open.where = seg.where, open.chunk = i;
+                    open.words += seg.words;
+                    continue;
+                }
+                segments.push_back({seg.base, wordBase[i] + seg.first, seg.words, seg.where, i});
+            }
+        }
+        checkOverlaps(segments, [&](const Segment& seg) { return streams[seg.chunk].lineOf(seg.where); });
+        sortDiagnostics();
+    }
+
+    // Same, pulling tokens straight from the Lexer: one traversal of the source.
+    void assembleOnePass(std::string_view source) {
+        LexerCursor cur(source);
+        runOnePass(cur);
+    }
+
+    const std::vector<InstructionCode>& output() const { return binaryOutput; }
+
+    // Errors from the last run, in source order; output() is only valid when
+    // this is empty. Lexical errors and I/O failures still throw.
+    const std::vector<Diagnostic>& diagnostics() const { return diags; }
+
+    // Labels defined by the last run, as fn(name, address) in no particular
+    // order. Names point into the source that was assembled.
+    template <typename Fn>
+    void forEachSymbol(Fn&& fn) const { symbolTable.forEach(fn); }
+    size_t symbolCount() const { return symbolTable.size(); }
+
+    // The output as placed runs of words, in source order, as fn(ImageSegment).
+    // Empty runs are dropped and runs that continue where the previous one
+    // ended are joined. Allocation-free; image() collects the same runs.
+    template <typename Fn>
+    void forEachSegment(Fn&& fn) const {
+        ImageSegment run{0, nullptr, 0};
+        for (const Segment& seg : segments) {
+            if (seg.words == 0) continue;
+            const InstructionCode* words = binaryOutput.data() + seg.first;
+            if (run.count && run.words + run.count == words && run.base + 4 * run.count == seg.base) {
+                run.count += seg.words;
+            } else {
+                if (run.count) fn(run);
+                run = {seg.base, words, seg.words};
+            }
+        }
+        if (run.count) fn(run);
+    }
+
+    std::vector<ImageSegment> image() const {
+        std::vector<ImageSegment> out;
+        forEachSegment([&](const ImageSegment& run) { out.push_back(run); });
+        return out;
+    }
+
+    void exportHex(const std::string& filename) const;
+};
+
+namespace detail {
+
+// Length of the common prefix of a and b. memcmp over blocks first: it is
+// vectorized, and an edit usually leaves megabytes on either side untouched.
+inline size_t commonPrefix(std::string_view a, std::string_view b) {
+    constexpr size_t kBlock = 4096;
+    const size_t n = std::min(a.size(), b.size());
+    size_t i = 0;
+    while (i + kBlock <= n && std::memcmp(a.data() + i, b.data() + i, kBlock) == 0) i += kBlock;
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
+}
+
+// Length of the common suffix of a and b, at most `limit`.
+inline size_t commonSuffix(std::string_view a, std::string_view b, size_t limit) {
+    constexpr size_t kBlock = 4096;
+    const char* ea = a.data() + a.size();
+    const char* eb = b.data() + b.size();
+    size_t i = 0;
+    while (i + kBlock <= limit && std::memcmp(ea - i - kBlock, eb - i - kBlock, kBlock) == 0) i += kBlock;
+    while (i < limit && ea[-1 - static_cast<ptrdiff_t>(i)] == eb[-1 - static_cast<ptrdiff_t>(i)]) ++i;
+    return i;
+}
+
+} // namespace detail
+
+// --watch: reassembles an edited source in time proportional to the edit.
+// It keeps a record per line of the last clean run: address, word index and
+// count, the label defined and the branch target (as label ids), and the
+// offset the words were encoded with. update() diffs the new text against the old by
+// line, re-lexes and re-encodes only the changed lines, re-addresses from the
+// first changed line until the addresses fall back into step, and re-patches
+// only the branches and jumps whose offsets moved. The output is always what
+// a full Assembler run gives.
+//
+// Whatever the records cannot express goes through a full Assembler run,
+// which is also what reports errors. That covers several statements on one
+// line, a label on an .org line, any error, and changes around .org lines.
+// A source with lines like that is reassembled in full on every update.
+class IncrementalAssembler {
+public:
+    // What the last update() changed in output().
+    struct Delta {
+        bool full = false;                // rebuilt from scratch: every word may have changed
+        size_t shiftedFrom = SIZE_MAX;    // words were added or removed here; all later ones moved
+        std::vector<size_t> rewritten;    // words changed in place, ascending, all before shiftedFrom
+        size_t linesRelexed = 0;
+    };
+
+private:
+    enum class LineKind : uint8_t { Blank, Instr, Org };
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Line {
+        Address pc = 0;          // of the instruction, where the label binds, or the .org target
+        uint32_t word = 0;       // index in `words` of the line's first word, or of the next one
+        uint32_t label = kNone;  // id of the label defined here
+        uint32_t target = kNone; // id of the label operand
+        int32_t offset = 0;      // the offset the label operand was encoded with
+        LineKind kind = LineKind::Blank;
+        uint8_t size = 0;        // words emitted: 0 unless an instruction, 2 for some pseudos
+        InstrType fixup = InstrType::R_TYPE; // Assembler::labelKind() of the instruction
+    };
+
+    // A line as scanLine() reads it, before its labels are resolved to ids.
+    struct Scan {
+        Line line;
+        size_t start = 0, end = 0; // the line's bytes
+        std::string_view label, target;
+        int32_t labelHash = 0, targetHash = 0;
+    };
+
+    // Labels by id. An id is stable while its label exists, so moving a label
+    // costs one store here and the name table is only touched when labels
+    // come and go.
+    struct Label {
+        Address address = 0;
+        uint32_t uses = 0;    // B/J operands naming it
+        bool defined = false; // false: free, or orphaned mid-update
+    };
+
+    Assembler core;           // encoder, and the full path
+    std::string text;         // the source `lines` describe
+    std::vector<Line> lines;
+    std::vector<uint32_t> starts; // offset of each line in `text`; apart, so shifting them is one tight loop
+    std::vector<uint32_t> targeted; // ascending indices of the lines with a label operand
+    std::vector<Scan> fresh;  // the lines being replaced in
+    std::vector<InstructionCode> words;
+    std::vector<Label> labels;
+    std::deque<std::string> labelNames; // by id; `ids` keys point into these, and a deque never moves them
+    std::vector<uint32_t> freeIds, orphans;
+    detail::SymbolTable ids;  // label name -> id
+    TokenStream scratch;
+    size_t orgLines = 0;
+    bool incremental = false; // `lines` describe `text` and `words`; false after errors
+    Delta delta;
+
+    static bool atLineStart(std::string_view s, size_t i) { return i == 0 || s[i - 1] == '\n'; }
+
+    static size_t lineEnd(std::string_view s, size_t from, size_t limit) {
+        const size_t eol = s.find('\n', from);
+        return eol == std::string_view::npos || eol >= limit ? limit : eol + 1;
+    }
+
+    // Lexes the line src[start, end) and describes it in `scan`. False when
+    // the line is not one of the shapes a record holds: blank, `label:`, an
+    // instruction with exactly its operands, `.org N`, or another directive
+    // (which both passes ignore), each optionally after one label.
+    bool scanLine(std::string_view src, size_t start, size_t end, Scan& scan) {
+        scan = Scan{};
+        scan.start = start;
+        scan.end = end;
+        Lexer(src.substr(start, end - start)).tokenizePacked(scratch);
+        const size_t n = scratch.size();
+        size_t i = 0;
+        if (i < n && scratch.kind(i) == Token::Label) {
+            scan.label = scratch.text(i);
+            scan.labelHash = scratch.value(i++);
+        }
+        if (i == n) return true;
+        const auto tk = scratch[i];
+        if (tk.kind == Token::Mnemonic) {
+            if (tk.value < 0) return false;
+            // As in Assembler::layout(): the token where a second syntax parts
+            // picks it (the line's end stands for the next statement), and
+            // li's immediate, its last token, decides its length.
+            int index = tk.value;
+            const detail::Overload& other = detail::kOverloads[static_cast<size_t>(index)];
+            const size_t fork = i + 1 + other.at;
+            if (other.index >= 0 && (fork < n ? ((other.accepts >> scratch.kind(fork)) & 1u) != 0 : fork == n && other.atEnd))
+                index = other.index;
+            if (n - i - 1 != static_cast<size_t>(Assembler::operandTokens(index))) return false;
+            scan.line.kind = LineKind::Instr;
+            scan.line.size = static_cast<uint8_t>(ISA::length(index, scratch.kind(n - 1) == Token::Immediate ? scratch.value(n - 1) : 0));
+            scan.line.fixup = Assembler::labelKind(ISA::defAt(index));
+            if (scan.line.fixup != InstrType::R_TYPE) {
+                const auto target = scratch[i + 1 + detail::operandShape(ISA::defAt(index).operands).find('l')];
+                scan.target = target.text;
+                // Same hashing as Assembler::encode, so lookups agree.
+                scan.targetHash = target.kind == Token::Mnemonic && target.value < 0 ? target.value : detail::symbolHash(target.text);
+            }
+            return true;
+        }
+        if (tk.kind == Token::Directive && tk.text == ".org") {
+            if (!scan.label.empty() || n != i + 2 || scratch.kind(i + 1) != Token::Immediate) return false;
+            scan.line.kind = LineKind::Org;
+            scan.line.pc = static_cast<Address>(scratch.value(i + 1));
+            return true;
+        }
+        if (tk.kind != Token::Directive) return false;
+        for (++i; i < n; ++i)
+            if (scratch.kind(i) == Token::Mnemonic || scratch.kind(i) == Token::Label || scratch.kind(i) == Token::Directive) return false;
+        return true;
+    }
+
+    // Gives a newly defined label an id. kNone if the name is already taken.
+    uint32_t define(std::string_view name, int32_t hash) {
+        if (const Address* id = ids.find(name, hash)) {
+            Label& label = labels[*id];
+            if (label.defined) return kNone;
+            label.defined = true; // a label on an edited line keeps its id
+            return *id;
+        }
+        uint32_t id;
+        if (freeIds.empty()) {
+            id = static_cast<uint32_t>(labels.size());
+            labels.emplace_back();
+            labelNames.emplace_back(name);
+        } else {
+            id = freeIds.back();
+            freeIds.pop_back();
+            labelNames[id].assign(name);
+        }
+        labels[id] = {0, 0, true};
+        ids.insert(labelNames[id], hash, id);
+        return id;
+    }
+
+    // Resolves the labels a scanned line defines and names. False on a
+    // duplicate or undefined label.
+    bool link(Scan& scan) {
+        if (!scan.label.empty() && (scan.line.label = define(scan.label, scan.labelHash)) == kNone) return false;
+        return true;
+    }
+    bool linkTarget(Scan& scan) {
+        if (scan.target.empty()) return true;
+        const Address* id = ids.find(scan.target, scan.targetHash);
+        if (!id) return false;
+        scan.line.target = *id;
+        ++labels[*id].uses;
+        return true;
+    }
+
+    // Assigns addresses and word indices from line `first` on, moving labels
+    // with their lines. Past line `settled` it stops at the first line already
+    // in step. True if any line from `settled` on moved.
+    bool address(size_t first, size_t settled) {
+        Address pc = 0;
+        uint32_t word = 0;
+        if (first > 0) {
+            const Line& prev = lines[first - 1];
+            pc = prev.pc + 4 * prev.size;
+            word = prev.word + prev.size;
+        }
+        for (size_t i = first; i < lines.size(); ++i) {
+            Line& line = lines[i];
+            if (i >= settled && line.word == word && (line.kind == LineKind::Org || line.pc == pc)) return i > settled;
+            if (line.kind == LineKind::Org) pc = line.pc;
+            else line.pc = pc;
+            if (line.label != kNone) labels[line.label].address = pc;
+            line.word = word;
+            pc += 4 * line.size;
+            word += line.size;
+        }
+        return settled < lines.size();
+    }
+
+    // Sets the offset fields of the words on `line` from its target's
+    // address, the way Assembler::applyFixups does. False if a branch or jump
+    // offset is odd or out of reach, which only a full run reports properly.
+    bool patch(Line& line) {
+        const int32_t offset = static_cast<int32_t>(labels[line.target].address - line.pc);
+        if (offset == line.offset) return true;
+        if (line.fixup != InstrType::U_TYPE && offset % 2 != 0) return false;
+        if (!ISA::reaches(line.fixup, offset)) return false;
+        ISA::retarget(&words[line.word], line.fixup, offset);
+        line.offset = offset;
+        return true;
+    }
+
+    // Re-patches the branches and jumps on lines [from, to), recording the
+    // words that change ahead of the shifted tail.
+    bool patchRange(size_t from, size_t to) {
+        auto it = std::lower_bound(targeted.begin(), targeted.end(), from);
+        for (; it != targeted.end() && *it < to; ++it) {
+            Line& line = lines[*it];
+            const int32_t before = line.offset;
+            if (!patch(line)) return false;
+            if (line.offset == before) continue;
+            for (uint32_t k = 0; k < line.size && line.word + k < delta.shiftedFrom; ++k) delta.rewritten.push_back(line.word + k);
+        }
+        return true;
+    }
+
+    // Encodes the instruction on `line`, text[start, end), with a zero offset
+    // field, which patch() then fills in. False on any error.
+    bool encodeLine(Line& line, size_t start, size_t end) {
+        Lexer(std::string_view(text).substr(start, end - start)).tokenizePacked(scratch);
+        StreamCursor cur(scratch);
+        auto tk = cur.take();
+        if (tk.kind == Token::Label) tk = cur.take();
+        // One-pass mode against an empty symbol table: label operands become
+        // fixups, which are dropped; `ids` knows the targets.
+        const auto enc = core.encode<true>(tk, cur, cur.mark(), line.pc, 0);
+        core.fixups.clear();
+        if (!enc || (*enc).count != line.size) return false;
+        for (int k = 0; k < line.size; ++k) words[line.word + k] = (*enc).words[k];
+        line.offset = 0;
+        return line.target == kNone || patch(line);
+    }
+
+    // Makes the range v[at, at + count) `with` elements long, moving the tail
+    // at most once. Elements kept keep their values; the caller overwrites them.
+    template <typename T>
+    static void resizeRange(std::vector<T>& v, size_t at, size_t count, size_t with) {
+        if (with > count) v.insert(v.begin() + at + count, with - count, T{});
+        else v.erase(v.begin() + at + with, v.begin() + at + count);
+    }
+
+    const Delta& rebuild(std::string source) {
+        delta = Delta{};
+        delta.full = true;
+        incremental = false;
+        text = std::move(source);
+        core.assemble(text);
+        if (!core.diagnostics().empty()) return delta;
+        words = core.output();
+        // encodeLine() needs it empty, and its names point into the old text.
+        core.symbolTable.clear();
+
+        lines.clear();
+        starts.clear();
+        targeted.clear();
+        fresh.clear();
+        labels.clear();
+        labelNames.clear();
+        freeIds.clear();
+        orphans.clear();
+        ids.clear();
+        orgLines = 0;
+        Scan scan;
+        for (size_t s = 0; s < text.size();) {
+            const size_t e = lineEnd(text, s, text.size());
+            ++delta.linesRelexed;
+            if (!scanLine(text, s, e, scan) || !link(scan)) return delta; // full runs only, from now on
+            fresh.push_back(scan);
+            s = e;
+        }
+        // Targets resolve once every label is defined: they may point forward.
+        for (Scan& sc : fresh) {
+            if (!linkTarget(sc)) return delta;
+            orgLines += sc.line.kind == LineKind::Org;
+            if (sc.line.target != kNone) targeted.push_back(static_cast<uint32_t>(lines.size()));
+            lines.push_back(sc.line);
+            starts.push_back(static_cast<uint32_t>(sc.start));
+        }
+        fresh.clear();
+        address(0, lines.size());
+        for (Line& line : lines)
+            if (line.target != kNone) line.offset = static_cast<int32_t>(labels[line.target].address - line.pc);
+        incremental = true;
+        return delta;
+    }
+
+public:
+    // Assembles `source`, reusing the previous run where the text is unchanged.
+    // Lexical errors throw, as Assembler::assemble does.
+    const Delta& update(std::string source) {
+        if (!incremental) return rebuild(std::move(source));
+
+        // The changed bytes, widened to whole lines on both sides.
+        size_t pre = detail::commonPrefix(text, source);
+        while (pre > 0 && text[pre - 1] != '\n') --pre;
+        const size_t suf = detail::commonSuffix(text, source, std::min(text.size(), source.size()) - pre);
+        size_t oldEnd = text.size() - suf, newEnd = source.size() - suf;
+        if (oldEnd < text.size() && !(atLineStart(text, oldEnd) && atLineStart(source, newEnd))) {
+            const size_t step = lineEnd(text, oldEnd, text.size()) - oldEnd; // the suffix is common: same in both
+            oldEnd += step;
+            newEnd += step;
+        }
+
+        // Old lines [first, last) give way to the lines of source[pre, newEnd).
+        const size_t first = static_cast<size_t>(std::lower_bound(starts.begin(), starts.end(), pre) - starts.begin());
+        const size_t last = static_cast<size_t>(std::lower_bound(starts.begin(), starts.end(), oldEnd) - starts.begin());
+        fresh.clear();
+        for (size_t s = pre; s < newEnd;) {
+            const size_t e = lineEnd(source, s, newEnd);
+            fresh.emplace_back();
+            if (!scanLine(source, s, e, fresh.back()) || fresh.back().line.kind == LineKind::Org) return rebuild(std::move(source));
+            s = e;
+        }
+        size_t oldWords = 0, newWords = 0, newTargeted = 0;
+        bool labelsTouched = false;
+        for (size_t i = first; i < last; ++i) {
+            const Line& line = lines[i];
+            if (line.kind == LineKind::Org) return rebuild(std::move(source));
+            oldWords += line.size;
+            if (line.target != kNone) --labels[line.target].uses;
+            if (line.label != kNone) {
+                labels[line.label].defined = false;
+                orphans.push_back(line.label);
+                labelsTouched = true;
+            }
+        }
+        // From here a failure leaves the records half updated; rebuild() starts over.
+        for (Scan& scan : fresh) {
+            if (!link(scan)) return rebuild(std::move(source));
+            labelsTouched |= !scan.label.empty();
+            newWords += scan.line.size;
+        }
+        for (Scan& scan : fresh) {
+            if (!linkTarget(scan)) return rebuild(std::move(source));
+            newTargeted += scan.line.target != kNone;
+        }
+        for (uint32_t id : orphans) {
+            if (labels[id].defined) continue;
+            if (labels[id].uses) return rebuild(std::move(source)); // still named somewhere
+            ids.erase(labelNames[id], detail::symbolHash(labelNames[id]));
+            freeIds.push_back(id);
+        }
+        orphans.clear();
+
+        delta = Delta{};
+        delta.linesRelexed = fresh.size();
+        const size_t firstWord = first < lines.size() ? lines[first].word : words.size();
+        resizeRange(lines, first, last - first, fresh.size());
+        resizeRange(starts, first, last - first, fresh.size());
+        for (size_t i = 0; i < fresh.size(); ++i) {
+            lines[first + i] = fresh[i].line;
+            starts[first + i] = static_cast<uint32_t>(fresh[i].start);
+        }
+        const size_t settled = first + fresh.size();
+        if (newEnd != oldEnd) {
+            const uint32_t shift = static_cast<uint32_t>(newEnd - oldEnd); // wraps for deletions
+            for (size_t i = settled; i < starts.size(); ++i) starts[i] += shift;
+        }
+        const size_t lo = static_cast<size_t>(std::lower_bound(targeted.begin(), targeted.end(), first) - targeted.begin());
+        const size_t hi = static_cast<size_t>(std::lower_bound(targeted.begin(), targeted.end(), last) - targeted.begin());
+        resizeRange(targeted, lo, hi - lo, newTargeted);
+        for (size_t i = first, t = lo; i < settled; ++i)
+            if (lines[i].target != kNone) targeted[t++] = static_cast<uint32_t>(i);
+        if (settled != last) {
+            const uint32_t shift = static_cast<uint32_t>(settled - last);
+            for (size_t t = lo + newTargeted; t < targeted.size(); ++t) targeted[t] += shift;
+        }
+        text = std::move(source);
+
+        const bool moved = address(first, settled);
+        if (moved && orgLines) return rebuild(std::move(text)); // segments may now collide
+
+        if (newWords != oldWords) {
+            delta.shiftedFrom = firstWord;
+            resizeRange(words, firstWord, oldWords, newWords);
+        }
+        // Branches and jumps elsewhere only change if they or their target
+        // moved. Lines are visited in order, so `rewritten` comes out sorted.
+        const bool repatch = moved || labelsTouched;
+        if (repatch && !patchRange(0, first)) return rebuild(std::move(text));
+        for (size_t i = first; i < settled; ++i) {
+            Line& line = lines[i];
+            if (line.kind != LineKind::Instr) continue;
+            if (!encodeLine(line, fresh[i - first].start, fresh[i - first].end)) return rebuild(std::move(text));
+            for (uint32_t k = 0; k < line.size && line.word + k < delta.shiftedFrom; ++k) delta.rewritten.push_back(line.word + k);
+        }
+        if (repatch && !patchRange(settled, lines.size())) return rebuild(std::move(text));
+        return delta;
+    }
+
+    const std::vector<InstructionCode>& output() const { return incremental ? words : core.output(); }
+    const std::vector<Diagnostic>& diagnostics() const { return core.diagnostics(); }
+    // False once a source needs full runs (errors, or lines the records cannot hold).
+    bool isIncremental() const { return incremental; }
+};
+
+// ============================================================================
+// 4. IMAGE WRITERS
+// ============================================================================
+enum class ImageFormat {
+    Hex,      // one 8-digit word per line, addresses dropped (the classic .hex)
+    Memh,     // $readmemh: the same words, with an @address record per segment
+    IntelHex, // Intel HEX, byte addressed, extended linear address records
+    Bin,      // raw little-endian bytes from the lowest address, gaps zero-filled (capped)
+    Elf,      // minimal ELF32 RISC-V executable, one PT_LOAD per segment
+};
+
+namespace detail {
+
+// "00".."ff": one table load per output byte instead of a stream manipulator.
+using HexPairs = std::array<std::array<char, 2>, 256>;
+constexpr HexPairs makeHexPairs(const char (&digits)[17]) {
+    HexPairs t{};
+    for (size_t i = 0; i < 256; ++i) t[i] = {digits[i >> 4], digits[i & 0xF]};
+    return t;
+}
+inline constexpr HexPairs kHexLower = makeHexPairs("0123456789abcdef");
+inline constexpr HexPairs kHexUpper = makeHexPairs("0123456789ABCDEF"); // Intel HEX convention
+
+} // namespace detail
+
+// Renders an image into one buffer and writes it with a single call. The
+// buffer is reused across formats and runs; every format sizes its output
+// up front and fills it through a raw pointer.
+class ImageWriter {
+    std::string buf;
+
+    char* grow(size_t n) {
+        size_t old = buf.size();
+        buf.resize(old + n);
+        return &buf[old];
+    }
+
+    static char* hex8(char* p, uint8_t v, const detail::HexPairs& digits = detail::kHexLower) {
+        p[0] = digits[v][0];
+        p[1] = digits[v][1];
+        return p + 2;
+    }
+    static char* hex32(char* p, uint32_t v) {
+        p = hex8(p, static_cast<uint8_t>(v >> 24));
+        p = hex8(p, static_cast<uint8_t>(v >> 16));
+        p = hex8(p, static_cast<uint8_t>(v >> 8));
+        return hex8(p, static_cast<uint8_t>(v));
+    }
+    static char* le16(char* p, uint16_t v) { p[0] = char(v); p[1] = char(v >> 8); return p + 2; }
+    static char* le32(char* p, uint32_t v) { p = le16(p, uint16_t(v)); return le16(p, uint16_t(v >> 16)); }
+
+    static char* hexWords(char* p, const ImageSegment& seg) {
+        for (size_t i = 0; i < seg.count; ++i) {
+            p = hex32(p, seg.words[i]);
+            *p++ = '\n';
+        }
+        return p;
+    }
+
+    // One Intel HEX record: ":LLAAAATT<data>CC\n".
+    static char* ihexRecord(char* p, uint8_t type, uint16_t addr, const uint8_t* data, uint8_t len) {
+        uint8_t sum = static_cast<uint8_t>(len + (addr >> 8) + addr + type);
+        *p++ = ':';
+        p = hex8(p, len, detail::kHexUpper);
+        p = hex8(p, static_cast<uint8_t>(addr >> 8), detail::kHexUpper);
+        p = hex8(p, static_cast<uint8_t>(addr), detail::kHexUpper);
+        p = hex8(p, type, detail::kHexUpper);
+        for (uint8_t i = 0; i < len; ++i) { p = hex8(p, data[i], detail::kHexUpper); sum = static_cast<uint8_t>(sum + data[i]); }
+        p = hex8(p, static_cast<uint8_t>(0x100 - sum), detail::kHexUpper);
+        *p++ = '\n';
+        return p;
+    }
+
+    void hex(const std::vector<ImageSegment>& image) {
+        size_t words = 0;
+        for (const auto& seg : image) words += seg.count;
+        char* p = grow(words * 9);
+        for (const auto& seg : image) p = hexWords(p, seg);
+    }
+
+    // Addresses count 32-bit words, matching a `reg [31:0] mem[]` target.
+    void memh(const std::vector<ImageSegment>& image) {
+        size_t words = 0;
+        for (const auto& seg : image) words += seg.count;
+        char* p = grow(words * 9 + image.size() * 10);
+        for (const auto& seg : image) {
+            *p++ = '@';
+            p = hex32(p, seg.base >> 2);
+            *p++ = '\n';
+            p = hexWords(p, seg);
+        }
+    }
+
+    void intelHex(const std::vector<ImageSegment>& image) {
+        constexpr size_t kData = 1 + 2 * (4 + 16 + 1) + 1, kAddress = 1 + 2 * (4 + 2 + 1) + 1, kEof = 11;
+        size_t bound = kEof;
+        for (const auto& seg : image)
+            bound += (seg.count * 4 / 16 + 2) * kData + (seg.count * 4 / 0x10000 + 2) * kAddress;
+        char* p = grow(bound);
+
+        bool haveUpper = false;
+        uint32_t upper = 0;
+        uint8_t chunk[16];
+        for (const auto& seg : image) {
+            uint32_t addr = seg.base;
+            for (size_t i = 0, bytes = seg.count * 4; i < bytes;) {
+                if (!haveUpper || (addr >> 16) != upper) {
+                    haveUpper = true;
+                    upper = addr >> 16;
+                    const uint8_t ext[2] = {static_cast<uint8_t>(upper >> 8), static_cast<uint8_t>(upper)};
+                    p = ihexRecord(p, 0x04, 0, ext, 2);
+                }
+                // Records stay 16-byte aligned, so none crosses a 64 KiB page.
+                const size_t len = std::min<size_t>(16 - (addr & 0xF), bytes - i);
+                if (len == 16 && i % 4 == 0) { // the common, word-aligned case
+                    for (size_t w = 0; w < 4; ++w) le32(reinterpret_cast<char*>(chunk) + 4 * w, seg.words[i / 4 + w]);
+                    i += 16;
+                } else {
+                    for (size_t b = 0; b < len; ++b, ++i) chunk[b] = static_cast<uint8_t>(seg.words[i / 4] >> (8 * (i % 4)));
+                }
+                p = ihexRecord(p, 0x00, static_cast<uint16_t>(addr), chunk, static_cast<uint8_t>(len));
+                addr += static_cast<uint32_t>(len);
+            }
+        }
+        p = ihexRecord(p, 0x01, 0, nullptr, 0);
+        buf.resize(static_cast<size_t>(p - buf.data()));
+    }
+
+    // The one flat format: gaps between segments must be materialized, so a
+    // sparse image that would balloon past kMaxBinGap is refused rather than
+    // written as gigabytes of zeros.
+    static constexpr uint64_t kMaxBinGap = 64u << 20;
+
+    void bin(const std::vector<ImageSegment>& image) {
+        if (image.empty()) return;
+        uint64_t lo = image.front().base, hi = lo, used = 0;
+        for (const auto& seg : image) {
+            lo = std::min<uint64_t>(lo, seg.base);
+            hi = std::max<uint64_t>(hi, seg.base + uint64_t(seg.count) * 4);
+            used += uint64_t(seg.count) * 4;
+        }
+        if (hi - lo - used > kMaxBinGap)
+            throw std::runtime_error("Image spans " + std::to_string((hi - lo) >> 20) + " MiB of address space; "
+                                     "use --format elf, ihex or memh for sparse images");
+        const size_t origin = buf.size();
+        grow(hi - lo); // zero-filled
+        for (const auto& seg : image) {
+            char* p = &buf[origin + (seg.base - lo)];
+            for (size_t i = 0; i < seg.count; ++i) p = le32(p, seg.words[i]);
+        }
+    }
+
+    // ELF header, one program header per segment, then the segment bytes.
+    // No section headers: loaders and simulators only need the PT_LOADs.
+    void elf(const std::vector<ImageSegment>& image) {
+        constexpr uint32_t kEhdr = 52, kPhdr = 32;
+        size_t words = 0;
+        for (const auto& seg : image) words += seg.count;
+        char* p = grow(kEhdr + kPhdr * image.size() + words * 4);
+
+        static const char ident[16] = {0x7F, 'E', 'L', 'F', 1 /*32-bit*/, 1 /*LE*/, 1 /*version*/};
+        std::copy(ident, ident + 16, p);
+        p += 16;
+        p = le16(p, 2);                                   // e_type: ET_EXEC
+        p = le16(p, 243);                                 // e_machine: EM_RISCV
+        p = le32(p, 1);                                   // e_version
+        p = le32(p, image.empty() ? 0 : image.front().base); // e_entry
+        p = le32(p, image.empty() ? 0 : kEhdr);           // e_phoff
+        p = le32(p, 0);                                   // e_shoff
+        p = le32(p, 0);                                   // e_flags
+        p = le16(p, kEhdr);                               // e_ehsize
+        p = le16(p, kPhdr);                               // e_phentsize
+        p = le16(p, static_cast<uint16_t>(image.size())); // e_phnum
+        p = le16(p, 0);                                   // e_shentsize
+        p = le16(p, 0);                                   // e_shnum
+        p = le16(p, 0);                                   // e_shstrndx
+
+        uint32_t offset = kEhdr + kPhdr * static_cast<uint32_t>(image.size());
+        for (const auto& seg : image) {
+            const uint32_t bytes = static_cast<uint32_t>(seg.count * 4);
+            p = le32(p, 1);        // p_type: PT_LOAD
+            p = le32(p, offset);   // p_offset
+            p = le32(p, seg.base); // p_vaddr
+            p = le32(p, seg.base); // p_paddr
+            p = le32(p, bytes);    // p_filesz
+            p = le32(p, bytes);    // p_memsz
+            p = le32(p, 5);        // p_flags: R+X
+            p = le32(p, 4);        // p_align
+            offset += bytes;
+        }
+        for (const auto& seg : image)
+            for (size_t i = 0; i < seg.count; ++i) p = le32(p, seg.words[i]);
+    }
+
+public:
+    // Replaces the buffer with `image` rendered as `format`.
+    const std::string& render(const std::vector<ImageSegment>& image, ImageFormat format) {
+        buf.clear();
+        switch (format) {
+        case ImageFormat::Hex:      hex(image); break;
+        case ImageFormat::Memh:     memh(image); break;
+        case ImageFormat::IntelHex: intelHex(image); break;
+        case ImageFormat::Bin:      bin(image); break;
+        case ImageFormat::Elf:      elf(image); break;
+        }
+        return buf;
+    }
+
+    const std::string& data() const { return buf; }
+
+    void save(const std::string& filename) const {
+        std::ofstream out(filename, std::ios::binary);
+        if (!out) throw std::runtime_error("Could not open output file " + filename);
+        out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        if (!out) throw std::runtime_error("Could not write output file " + filename);
+    }
+};
+
+inline void Assembler::exportHex(const std::string& filename) const {
+    ImageWriter writer;
+    writer.render(image(), ImageFormat::Hex);
+    writer.save(filename);
+    std::cout << "[Info] Hex file written to " << filename << "\n";
+}
+
+// ============================================================================
+// 5. COMPILE-TIME ASSEMBLY
+// ============================================================================
+// The Lexer's scalar path, pass 1's layout() and the encoder all run in
+// constant expressions, over the same ISA tables. ConstAssembler drives
+// them into fixed-size storage: shape() is pass 1 and sizes the run,
+// assemble() is pass 2. Like the runtime assembler's output(), the words are
+// in source order; .org moves addresses but adds no fill. It stops at the
+// first error, and overlapping .org segments are not diagnosed.
+class ConstAssembler {
+    struct Label {
+        std::string_view name;
+        int32_t hash = 0;
+        Address pc = 0;
+    };
+
+public:
+    struct Shape {
+        size_t words = 0, labels = 0;
+    };
+
+    // The words, or the first error and its line.
+    template <size_t Words>
+    struct Result {
+        std::array<InstructionCode, Words> words{};
+        bool ok = true;
+        detail::Errc code{};
+        size_t line = 0;
+    };
+
+    static constexpr Shape shape(std::string_view source) {
+        LexerCursor cur(source);
+        Shape s;
+        s.words = Assembler::layout(cur, 0, [&](std::string_view, int32_t, Address, bool, size_t) { ++s.labels; }).words;
+        return s;
+    }
+
+    template <size_t Words, size_t Labels>
+    static constexpr Result<Words> assemble(std::string_view source) {
+        using detail::Errc;
+        Result<Words> r;
+        auto fail = [&](Errc code, size_t line) {
+            if (r.ok) r = {{}, false, code, line};
+        };
+        std::array<Label, Labels> labels{};
+        size_t defined = 0;
+        auto find = [&](std::string_view name, int32_t hash) -> const Label* {
+            for (size_t i = 0; i < defined; ++i)
+                if (labels[i].hash == hash && labels[i].name == name) return &labels[i];
+            return nullptr;
+        };
+
+        LexerCursor scan(source);
+        Assembler::layout(scan, 0, [&](std::string_view name, int32_t hash, Address pc, bool, size_t line) {
+            if (find(name, hash)) fail(Errc::DuplicateLabel, line);
+            else if (defined < Labels) labels[defined++] = {name, hash, pc};
+        });
+
+        // Pass 2, as Assembler::runPass2 without recovery.
+        LexerCursor cur(source);
+        Address pc = 0;
+        size_t emitted = 0;
+        while (r.ok && !cur.done()) {
+            const auto tk = cur.take();
+            if (tk.kind == Token::Directive && tk.text == ".org") {
+                if (!cur.done() && cur.peekKind() == Token::Immediate) pc = static_cast<Address>(cur.take().value);
+                continue;
+            }
+            if (tk.kind != Token::Mnemonic) continue;
+            const auto enc = Assembler::encodeWith(tk, cur, cur.mark(), [&](std::string_view name, int32_t hash, InstrType) -> std::optional<int32_t> {
+                if (const Label* l = find(name, hash)) return static_cast<int32_t>(l->pc - pc);
+                return std::nullopt;
+            });
+            if (!enc) { fail(enc.error().code, cur.lineAt(enc.error().where)); break; }
+            for (int k = 0; k < (*enc).count; ++k)
+                if (emitted < Words) r.words[emitted++] = (*enc).words[k];
+            pc += 4 * static_cast<Address>((*enc).count);
+        }
+        return r;
+    }
+};
+
+#if defined(__cpp_consteval) && defined(__cpp_nontype_template_args) && __cpp_nontype_template_args >= 201911L
+namespace detail {
+
+// A string literal as a template argument.
+template <size_t N>
+struct SourceLiteral {
+    char text[N] = {};
+    consteval SourceLiteral(const char (&s)[N]) {
+        for (size_t i = 0; i < N; ++i) text[i] = s[i];
+    }
+    constexpr std::string_view view() const { return {text, N - 1}; }
+};
+
+// Named in the compiler's note when assembleConst fails: the error code and
+// the line of the embedded source.
+template <Errc Code, size_t Line>
+struct AssemblyError {
+    static constexpr bool reported = false;
+};
+
+} // namespace detail
+
+// Assembles `Source` at compile time (C++20):
+//   constexpr auto boot = rv32::assembleConst<R"(
+//       addi x1, x0, 10
+//   loop:
+//       addi x1, x1, -1
+//       bne  x1, x0, loop
+//   )">();   // std::array<uint32_t, 3>
+// Assembly errors fail the static_assert below; lexer errors surface as the
+// throw in Lexer::lexOne that could not be evaluated.
+template <detail::SourceLiteral Source>
+consteval auto assembleConst() {
+    constexpr ConstAssembler::Shape shape = ConstAssembler::shape(Source.view());
+    constexpr auto result = ConstAssembler::assemble<shape.words, shape.labels>(Source.view());
+    static_assert(result.ok || detail::AssemblyError<result.code, result.line>::reported,
+                  "RV32 assembly failed: see AssemblyError<code, line> in the note below");
+    return result.words;
+}
+#endif
+
+} // namespace rv32
@@ -0,0 +1,1091 @@
+// rv32_bench.cpp
+// Microbenchmarks for the assembler internals. Pulls in rv32_asm.cpp without its driver.
+// g++ -std=c++17 -O2 -pthread rv32_bench.cpp -o bench : in termial
+// ./bench [iterations] [--phases] [--max-instructions N] [--json results.json]
+//   --phases runs only the per-phase sweep (1k instructions up to N, default
+//   10M); --json also writes its rows there, to diff against a baseline run.
+
+#define RV32_ASM_NO_MAIN
+#include "rv32_asm.cpp"
+#include "rv32_emit.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <random>
+
+// Global allocation counters: every operator new in the process bumps them.
+static std::atomic<size_t> gAllocations{0};
+static std::atomic<size_t> gAllocatedBytes{0};
+
+void* operator new(std::size_t n) {
+    ++gAllocations;
+    gAllocatedBytes += n;
+    if (void* p = std::malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+// Out of line: GCC flags free() on operator new results once it inlines these.
+#if defined(__GNUC__)
+#define RV32_BENCH_NOINLINE __attribute__((noinline))
+#else
+#define RV32_BENCH_NOINLINE
+#endif
+RV32_BENCH_NOINLINE void operator delete(void* p) noexcept { std::free(p); }
+RV32_BENCH_NOINLINE void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace bench {
+
+using Clock = std::chrono::steady_clock;
+
+// Keeps the optimizer from discarding benchmark results.
+static volatile uint32_t sink;
+
+// ---------------------------------------------------------------------------
+// Reference: the original heap-string + std::unordered_map lookups.
+// ---------------------------------------------------------------------------
+namespace legacy {
+
+static std::optional<uint8_t> getRegister(std::string_view reg_sv) {
+    static const std::unordered_map<std::string, uint8_t> regs = {
+        {"x0", 0}, {"zero", 0}, {"x1", 1}, {"ra", 1}, {"x2", 2}, {"sp", 2},
+        {"x3", 3}, {"gp", 3},   {"x4", 4}, {"tp", 4}, {"x5", 5}, {"t0", 5},
+        {"x6", 6}, {"t1", 6},   {"x7", 7}, {"t2", 7}, {"x8", 8}, {"s0", 8}, {"fp", 8},
+        {"x9", 9}, {"s1", 9}, {"x10", 10}, {"a0", 10}, {"x11", 11}, {"a1", 11},
+        {"x12", 12}, {"a2", 12}, {"x13", 13}, {"a3", 13}, {"x14", 14}, {"a4", 14},
+        {"x15", 15}, {"a5", 15}, {"x16", 16}, {"a6", 16}, {"x17", 17}, {"a7", 17},
+        {"x18", 18}, {"s2", 18}, {"x19", 19}, {"s3", 19}, {"x20", 20}, {"s4", 20},
+        {"x21", 21}, {"s5", 21}, {"x22", 22}, {"s6", 22}, {"x23", 23}, {"s7", 23},
+        {"x24", 24}, {"s8", 24}, {"x25", 25}, {"s9", 25}, {"x26", 26}, {"s10", 26},
+        {"x27", 27}, {"s11", 27}, {"x28", 28}, {"t3", 28}, {"x29", 29}, {"t4", 29},
+        {"x30", 30}, {"t5", 30}, {"x31", 31}, {"t6", 31}
+    };
+    std::string key(reg_sv);
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    auto it = regs.find(key);
+    if (it != regs.end()) return it->second;
+    return std::nullopt;
+}
+
+static std::optional<uint32_t> getOpcode(std::string_view mnemonic_sv) {
+    static const std::unordered_map<std::string, uint32_t> table = {
+        {"add", 0x33}, {"sub", 0x33}, {"xor", 0x33}, {"or", 0x33}, {"and", 0x33},
+        {"sll", 0x33}, {"srl", 0x33}, {"sra", 0x33}, {"slt", 0x33}, {"sltu", 0x33},
+        {"addi", 0x13}, {"xori", 0x13}, {"ori", 0x13}, {"andi", 0x13}, {"slli", 0x13},
+        {"srli", 0x13}, {"srai", 0x13}, {"slti", 0x13}, {"sltiu", 0x13},
+        {"lb", 0x03}, {"lh", 0x03}, {"lw", 0x03}, {"lbu", 0x03}, {"lhu", 0x03}, {"jalr", 0x67},
+        {"sb", 0x23}, {"sh", 0x23}, {"sw", 0x23},
+        {"beq", 0x63}, {"bne", 0x63}, {"blt", 0x63}, {"bge", 0x63}, {"bltu", 0x63}, {"bgeu", 0x63},
+        {"lui", 0x37}, {"auipc", 0x17}, {"jal", 0x6F},
+        {"nop", 0x13}, {"mv", 0x13}, {"not", 0x13},
+    };
+    std::string key(mnemonic_sv);
+    std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+    auto it = table.find(key);
+    if (it != table.end()) return it->second;
+    return std::nullopt;
+}
+
+} // namespace legacy
+
+// Roughly the word mix the Lexer sees: registers, mnemonics and label names.
+static const std::vector<std::string_view> kWords = {
+    "addi", "x1", "x0", "add", "x3", "x1", "x2", "beq", "x3", "x0", "loop",
+    "LW", "A0", "sp", "sw", "ra", "s11", "jal", "zero", "end", "T6", "bgeu",
+    "lui", "gp", "fp", "auipc", "handler_42", "srai", "t2", "Xor", "nop",
+};
+
+template <typename Fn>
+static void report(const char* name, size_t iterations, Fn&& fn) {
+    auto t0 = Clock::now();
+    uint32_t acc = 0;
+    for (size_t it = 0; it < iterations; ++it)
+        for (std::string_view w : kWords) acc += fn(w);
+    auto t1 = Clock::now();
+    sink = acc;
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    double lookups = static_cast<double>(iterations * kWords.size());
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << lookups / secs / 1e6 << " M lookups/s\n";
+}
+
+static void isaLookups(size_t iterations) {
+    std::cout << "--- ISA lookups (" << kWords.size() * iterations << " words) ---\n";
+    report("getRegister [unordered_map]", iterations, [](std::string_view w) {
+        auto r = legacy::getRegister(w); return r ? *r : 0xFFu; });
+    report("getRegister [perfect hash]", iterations, [](std::string_view w) {
+        auto r = rv32::ISA::getRegister(w); return r ? *r : 0xFFu; });
+    report("getDef [unordered_map]", iterations, [](std::string_view w) {
+        auto d = legacy::getOpcode(w); return d ? *d : 0u; });
+    report("getDef [perfect hash]", iterations, [](std::string_view w) {
+        auto d = rv32::ISA::getDef(w); return d ? d->opcode : 0u; });
+}
+
+// ---------------------------------------------------------------------------
+// Symbol table: define then resolve every label of a fully unrolled program
+// ---------------------------------------------------------------------------
+static void symbolTables(size_t labels) {
+    std::string names;
+    std::vector<size_t> ends;
+    for (size_t i = 0; i < labels; ++i) { names += "L" + std::to_string(i * 2654435761u % 1000000007u); ends.push_back(names.size()); }
+    std::vector<std::string_view> views;
+    std::vector<int32_t> hashes; // computed by the lexer in the real pipeline
+    for (size_t i = 0, b = 0; i < labels; b = ends[i++]) {
+        views.push_back(std::string_view(names).substr(b, ends[i] - b));
+        hashes.push_back(rv32::detail::symbolHash(views.back()));
+    }
+    std::cout << "--- Symbol table (" << labels << " labels) ---\n";
+    auto run = [&](const char* name, auto&& define, auto&& resolve) {
+        auto t0 = Clock::now();
+        for (size_t i = 0; i < labels; ++i) define(i, static_cast<rv32::Address>(i * 4));
+        auto t1 = Clock::now();
+        uint32_t acc = 0;
+        for (size_t i = 0; i < labels; ++i) acc += resolve((i * 7919) % labels);
+        auto t2 = Clock::now();
+        sink = acc;
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << labels / std::chrono::duration<double>(t1 - t0).count() / 1e6 << " M defs/s"
+                  << std::setw(10) << labels / std::chrono::duration<double>(t2 - t1).count() / 1e6 << " M lookups/s\n";
+    };
+    {
+        std::unordered_map<std::string, rv32::Address> table;
+        run("unordered_map<string>",
+            [&](size_t i, rv32::Address pc) { std::string n(views[i]); if (!table.count(n)) table.emplace(std::move(n), pc); },
+            [&](size_t i) { std::string n(views[i]); return table.find(n) != table.end() ? table[n] : 0u; });
+    }
+    {
+        rv32::detail::SymbolTable table;
+        run("flat, interned + prehashed",
+            [&](size_t i, rv32::Address pc) { table.insert(views[i], hashes[i], pc); },
+            [&](size_t i) { auto* a = table.find(views[i], hashes[i]); return a ? *a : 0u; });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Lexer back-ends
+// ---------------------------------------------------------------------------
+
+// Deterministic assembly text with a realistic mix of indentation, comments
+// and blank lines. Every 16 lines open a new `loopN:` block, which the branches
+// and jumps in it target, so every offset is in reach; `end` closes the source.
+static std::string makeSource(size_t lines) {
+    static const char* const body[] = {
+        "    addi x1, x0, 10\n", "    add  x3, x1, x2   # accumulate\n", "\tlw   a0, -12(sp)\n",
+        "    sw   ra, 0x10(sp)\n", "    beq  x3, x0, loop", "\n", "# ---- block comment ----\n",
+        "    lui  t0, 0x12345\n", "    jal  ra, loop", "    xori s1, s1, -1\n",
+    };
+    std::string src;
+    src.reserve(lines * 24);
+    for (size_t i = 0; i < lines; ++i) {
+        std::string block = std::to_string(i / 16);
+        if (i % 16 == 0) src += "loop" + block + ":\n";
+        std::string_view l = body[(i * 7) % (sizeof(body) / sizeof(body[0]))];
+        src += l;
+        if (l.back() != '\n') src += block + "\n";
+    }
+    src += "end:\n    nop";
+    return src;
+}
+
+static bool sameTokens(const std::vector<rv32::Token>& a, const std::vector<rv32::Token>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i)
+        if (a[i].kind != b[i].kind || a[i].text.data() != b[i].text.data() ||
+            a[i].text.size() != b[i].text.size() || a[i].lineNum != b[i].lineNum) return false;
+    return true;
+}
+
+static void lexerPaths(size_t lines) {
+    using Path = rv32::Lexer::Path;
+    const std::string src = makeSource(lines);
+    std::cout << "--- Lexer::tokenize (" << src.size() / 1024 << " KiB) ---\n";
+
+    const auto reference = rv32::Lexer(src).tokenize(Path::Scalar);
+    // Every line-aligned prefix of a small program exercises the tail handling
+    // of each path.
+    const std::string small = makeSource(32);
+    for (size_t len = 0; len <= small.size(); ++len) {
+        if (len < small.size() && small[len] != '\n') continue;
+        std::string_view part(small.data(), len);
+        auto expect = rv32::Lexer(part).tokenize(Path::Scalar);
+        for (Path p : {Path::SSE42, Path::AVX2})
+            if (rv32::Lexer::supports(p) && !sameTokens(expect, rv32::Lexer(part).tokenize(p)))
+                throw std::runtime_error("Lexer paths disagree");
+    }
+
+    const std::pair<const char*, Path> paths[] = {
+        {"scalar", Path::Scalar}, {"sse4.2", Path::SSE42}, {"avx2", Path::AVX2}};
+    for (const auto& [name, path] : paths) {
+        if (!rv32::Lexer::supports(path)) { std::cout << std::left << std::setw(28) << name << "  (unsupported)\n"; continue; }
+        double secs = 1e30;
+        std::vector<rv32::Token> tokens;
+        for (int rep = 0; rep < 3; ++rep) { // best of three
+            auto t0 = Clock::now();
+            tokens = rv32::Lexer(src).tokenize(path);
+            auto t1 = Clock::now();
+            secs = std::min(secs, std::chrono::duration<double>(t1 - t0).count());
+        }
+        if (!sameTokens(reference, tokens)) throw std::runtime_error("Lexer paths disagree");
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << src.size() / secs / 1e6 << " MB/s  "
+                  << std::setw(10) << tokens.size() / secs / 1e6 << " M tokens/s\n";
+    }
+}
+
+static void tokenStorage(size_t lines) {
+    const std::string src = makeSource(lines);
+    std::cout << "--- Token storage ---\n";
+    auto fat = rv32::Lexer(src).tokenize();
+    auto t0 = Clock::now();
+    auto packed = rv32::Lexer(src).tokenizePacked();
+    auto t1 = Clock::now();
+    size_t packedBytes = packed.bytes();
+
+    if (packed.size() != fat.size()) throw std::runtime_error("Packed stream size mismatch");
+    for (size_t i = 0; i < fat.size(); ++i) {
+        rv32::Token t = packed.materialize(i);
+        if (t.kind != fat[i].kind || t.text.data() != fat[i].text.data() ||
+            t.text.size() != fat[i].text.size() || t.lineNum != fat[i].lineNum)
+            throw std::runtime_error("Packed stream disagrees with std::vector<Token>");
+    }
+
+    double secs = std::chrono::duration<double>(t1 - t0).count();
+    std::cout << std::left << std::setw(28) << "std::vector<Token>" << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << double(fat.capacity() * sizeof(rv32::Token)) / fat.size() << " B/token\n"
+              << std::left << std::setw(28) << "TokenStream" << std::right
+              << std::setw(10) << double(packedBytes) / packed.size() << " B/token  "
+              << std::setw(10) << packed.size() / secs / 1e6 << " M tokens/s\n"
+              << std::left << std::setw(28) << "  + line index (lazy)" << std::right
+              << std::setw(10) << double(packed.bytes() - packedBytes) / packed.size() << " B/token\n";
+}
+
+// ---------------------------------------------------------------------------
+// Assembler passes
+// ---------------------------------------------------------------------------
+static void assemblerThroughput(size_t lines) {
+    const std::string src = makeSource(lines);
+    double secs[3] = {1e30, 1e30, 1e30};
+    size_t instructions = 0, pass2Allocations = 0;
+    for (int rep = 0; rep < 3; ++rep) { // best of three
+        auto t0 = Clock::now();
+        rv32::Assembler asmCore(rv32::Lexer(src).tokenizePacked());
+        auto t1 = Clock::now();
+        asmCore.pass1();
+        auto t2 = Clock::now();
+        const size_t allocsBefore = gAllocations;
+        asmCore.pass2();
+        auto t3 = Clock::now();
+        pass2Allocations = gAllocations - allocsBefore;
+        instructions = asmCore.output().size();
+        secs[0] = std::min(secs[0], std::chrono::duration<double>(t1 - t0).count());
+        secs[1] = std::min(secs[1], std::chrono::duration<double>(t2 - t1).count());
+        secs[2] = std::min(secs[2], std::chrono::duration<double>(t3 - t2).count());
+    }
+    std::cout << "--- Assembler (" << instructions << " instructions) ---\n";
+    const char* names[] = {"tokenizePacked", "pass1", "pass2"};
+    for (int p = 0; p < 3; ++p)
+        std::cout << std::left << std::setw(28) << names[p] << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << instructions / secs[p] / 1e6 << " M instr/s\n";
+    std::cout << std::left << std::setw(28) << "total" << std::right
+              << std::setw(10) << instructions / (secs[0] + secs[1] + secs[2]) / 1e6 << " M instr/s\n";
+    std::cout << std::left << std::setw(28) << "pass2 heap allocations" << std::right << std::setw(10) << pass2Allocations << "\n";
+
+    // One-pass with fixups, straight from the source text.
+    rv32::Assembler twoPass(rv32::Lexer(src).tokenizePacked());
+    twoPass.pass1();
+    twoPass.pass2();
+    double onePassSecs = 1e30;
+    for (int rep = 0; rep < 3; ++rep) {
+        rv32::Assembler onePass;
+        auto t0 = Clock::now();
+        onePass.assembleOnePass(src);
+        auto t1 = Clock::now();
+        onePassSecs = std::min(onePassSecs, std::chrono::duration<double>(t1 - t0).count());
+        if (onePass.output() != twoPass.output()) throw std::runtime_error("One-pass output differs from two-pass");
+    }
+    std::cout << std::left << std::setw(28) << "assembleOnePass(source)" << std::right
+              << std::setw(10) << instructions / onePassSecs / 1e6 << " M instr/s\n";
+}
+
+// ---------------------------------------------------------------------------
+// Encoding pre-parsed operands, no text: one word at a time vs. encodeMany
+// ---------------------------------------------------------------------------
+static void batchEncoding(size_t words) {
+    using rv32::ISA;
+    std::vector<uint8_t> rd(words), rs1(words), rs2(words);
+    std::vector<int32_t> imm(words);
+    uint32_t x = 12345;
+    for (size_t i = 0; i < words; ++i) {
+        x = x * 1664525u + 1013904223u;
+        rd[i] = x >> 27;
+        rs1[i] = (x >> 22) & 31;
+        rs2[i] = (x >> 17) & 31;
+        imm[i] = static_cast<int32_t>(x << 20) >> 19; // even, within B reach
+    }
+    const ISA::OperandArrays ops{rd.data(), rs1.data(), rs2.data(), imm.data()};
+    std::vector<rv32::InstructionCode> out(words), ref(words);
+    std::cout << "--- Batch encoding (" << words << " words per mnemonic) ---\n";
+    for (const char* name : {"add", "addi", "srai", "sw", "beq", "lui", "jal"}) {
+        const int index = ISA::getDefIndex(name);
+        double scalarSecs = 1e30, batchSecs = 1e30;
+        for (int rep = 0; rep < 3; ++rep) {
+            auto t0 = Clock::now();
+            for (size_t i = 0; i < words; ++i) ref[i] = ISA::encode(index, rd[i], rs1[i], rs2[i], imm[i]);
+            auto t1 = Clock::now();
+            ISA::encodeMany(index, ops, out.data(), words);
+            auto t2 = Clock::now();
+            scalarSecs = std::min(scalarSecs, std::chrono::duration<double>(t1 - t0).count());
+            batchSecs = std::min(batchSecs, std::chrono::duration<double>(t2 - t1).count());
+        }
+        if (out != ref) throw std::runtime_error(std::string("encodeMany differs for ") + name);
+        const std::string row = std::string(name) + " encode / encodeMany";
+        std::cout << std::left << std::setw(28) << row << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << words / scalarSecs / 1e6 << std::setw(10) << words / batchSecs / 1e6 << " M words/s\n";
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Program generation: printing text and assembling it vs. the Emitter
+// ---------------------------------------------------------------------------
+static void programGeneration(size_t instructions) {
+    using namespace rv32::regs;
+    const int kinds[] = {rv32::ISA::getDefIndex("add"), rv32::ISA::getDefIndex("addi"), rv32::ISA::getDefIndex("lw"),
+                         rv32::ISA::getDefIndex("sw"),  rv32::ISA::getDefIndex("beq"),  rv32::ISA::getDefIndex("jal")};
+    // The same random program both ways: a label every 16 instructions, each
+    // branch or jump to the label of the previous or the next block.
+    auto generate = [&](auto&& onLabel, auto&& onInstr) {
+        uint32_t x = 12345;
+        for (size_t i = 0; i < instructions; ++i) {
+            if (i % 16 == 0) onLabel(i / 16);
+            x = x * 1664525u + 1013904223u;
+            const size_t block = i / 16 + ((x >> 8) & 1 ? 1 : 0);
+            onInstr(kinds[(x >> 29) % 6], rv32::Reg{static_cast<uint8_t>(1 + (x >> 9) % 31)},
+                    rv32::Reg{static_cast<uint8_t>((x >> 14) & 31)}, static_cast<int32_t>((x >> 19) & 0x7FC) - 1024,
+                    std::min(block, (instructions - 1) / 16));
+        }
+    };
+
+    double textSecs = 1e30, emitSecs = 1e30;
+    rv32::Assembler asmCore;
+    rv32::CodeBuffer code;
+    for (int rep = 0; rep < 3; ++rep) {
+        auto t0 = Clock::now();
+        std::string src;
+        src.reserve(instructions * 24);
+        generate([&](size_t block) { src += "L" + std::to_string(block) + ":\n"; },
+                 [&](int index, rv32::Reg a, rv32::Reg b, int32_t imm, size_t block) {
+                     const std::string ra = "x" + std::to_string(a.n), rb = "x" + std::to_string(b.n);
+                     const std::string name(rv32::ISA::nameAt(index));
+                     switch (rv32::ISA::defAt(index).operands) {
+                     case rv32::Operands::RdRs1Rs2: src += name + " " + ra + ", " + rb + ", " + rb + "\n"; break;
+                     case rv32::Operands::RdRs1Imm: src += name + " " + ra + ", " + rb + ", " + std::to_string(imm) + "\n"; break;
+                     case rv32::Operands::RdMem:
+                     case rv32::Operands::Rs2Mem: src += name + " " + ra + ", " + std::to_string(imm) + "(" + rb + ")\n"; break;
+                     case rv32::Operands::Rs1Rs2Label: src += name + " " + ra + ", " + rb + ", L" + std::to_string(block) + "\n"; break;
+                     default: src += name + " " + ra + ", L" + std::to_string(block) + "\n"; break;
+                     }
+                 });
+        asmCore.assemble(src);
+        auto t1 = Clock::now();
+
+        code.clear();
+        code.reserve(instructions);
+        rv32::Emitter e(code);
+        std::vector<rv32::Label> labels((instructions + 15) / 16);
+        for (auto& l : labels) l = e.newLabel();
+        generate([&](size_t block) { e.bind(labels[block]); },
+                 [&](int index, rv32::Reg a, rv32::Reg b, int32_t imm, size_t block) {
+                     switch (rv32::ISA::defAt(index).operands) {
+                     case rv32::Operands::RdRs1Rs2: e.emit(index, a, b, b, 0); break;
+                     case rv32::Operands::RdRs1Imm:
+                     case rv32::Operands::RdMem: e.emit(index, a, b, x0, imm); break;
+                     case rv32::Operands::Rs2Mem: e.emit(index, x0, b, a, imm); break;
+                     case rv32::Operands::Rs1Rs2Label: e.emit(index, x0, a, b, labels[block]); break;
+                     default: e.emit(index, a, x0, x0, labels[block]); break;
+                     }
+                 });
+        e.finalize();
+        auto t2 = Clock::now();
+        textSecs = std::min(textSecs, std::chrono::duration<double>(t1 - t0).count());
+        emitSecs = std::min(emitSecs, std::chrono::duration<double>(t2 - t1).count());
+    }
+    if (!asmCore.diagnostics().empty() || code.code() != asmCore.output())
+        throw std::runtime_error("Emitter output differs from the assembled text");
+
+    // What the Assembler rejects as out of range, the Emitter throws on: a
+    // branch past 4 KiB back or forward, a jump 1 MiB forward, and
+    // immediates one past their field.
+    auto throws = [](const char* what, auto&& fn) {
+        rv32::CodeBuffer buf;
+        rv32::Emitter e(buf);
+        try {
+            fn(e);
+            e.finalize();
+        } catch (const std::runtime_error&) {
+            return;
+        }
+        throw std::runtime_error(std::string("Emitter accepted ") + what);
+    };
+    auto pad = [](rv32::Emitter& e, size_t words) { for (size_t i = 0; i < words; ++i) e.nop(); };
+    throws("a branch 4100 bytes back", [&](rv32::Emitter& e) {
+        auto l = e.newLabel();
+        e.bind(l);
+        pad(e, 1025);
+        e.beq(x1, x2, l);
+    });
+    throws("a branch 4096 bytes forward", [&](rv32::Emitter& e) {
+        auto l = e.newLabel();
+        e.bne(x1, x2, l);
+        pad(e, 1023);
+        e.bind(l);
+    });
+    throws("a jump 1 MiB forward", [&](rv32::Emitter& e) {
+        auto l = e.newLabel();
+        e.jal(ra, l);
+        pad(e, (1 << 18) - 1);
+        e.bind(l);
+    });
+    throws("addi 2048", [](rv32::Emitter& e) { e.addi(x1, x1, 2048); });
+    throws("slli 32", [](rv32::Emitter& e) { e.slli(x1, x1, 32); });
+    throws("sw -2049", [](rv32::Emitter& e) { e.sw(x1, -2049, x2); });
+    throws("lui 0x100000", [](rv32::Emitter& e) { e.lui(x1, 0x100000); });
+    throws("emit(addi, 4096)", [](rv32::Emitter& e) { e.emit(rv32::ISA::getDefIndex("addi"), x1, x1, x0, 4096); });
+    {
+        rv32::CodeBuffer buf; // and the last offsets in reach still encode
+        rv32::Emitter e(buf);
+        auto back = e.newLabel(), ahead = e.newLabel();
+        e.bind(back);
+        pad(e, 1024);
+        e.beq(x1, x2, back);   // -4096
+        e.bne(x1, x2, ahead);  // +4092
+        pad(e, 1022);
+        e.bind(ahead);
+        e.finalize();
+    }
+    std::cout << "--- Program generation (" << instructions << " instructions) ---\n";
+    std::cout << std::left << std::setw(28) << "text + assemble" << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << instructions / textSecs / 1e6 << " M instr/s\n";
+    std::cout << std::left << std::setw(28) << "Emitter" << std::right
+              << std::setw(10) << instructions / emitSecs / 1e6 << " M instr/s\n";
+}
+
+// ---------------------------------------------------------------------------
+// Source input: std::ifstream copy vs. memory mapping
+// ---------------------------------------------------------------------------
+
+// Resident set split from /proc/self/status, in KiB (0 where unavailable).
+static size_t statusKb(const char* key) {
+    std::ifstream in("/proc/self/status");
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, std::strlen(key), key) == 0) return std::stoul(line.substr(std::strlen(key) + 1));
+    return 0;
+}
+
+// Live heap bytes (glibc), or resident anonymous memory elsewhere. RSS alone
+// hides reuse of memory freed by earlier sections.
+static size_t heapInUseKb() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    struct mallinfo2 mi = mallinfo2();
+    return (mi.uordblks + mi.hblkhd) / 1024; // arena + mmap-backed blocks
+#else
+    return statusKb("RssAnon");
+#endif
+}
+
+struct InputSample {
+    Clock::time_point t;
+    size_t heapKb, fileKb, items;
+};
+
+// `fn` loads and lexes, then calls sample(items) while everything is alive.
+template <typename Fn>
+static void measureInput(const char* name, Fn&& fn) {
+    InputSample before{Clock::now(), heapInUseKb(), statusKb("RssFile"), 0}, after = before;
+    fn([&](size_t items) { after = {Clock::now(), heapInUseKb(), statusKb("RssFile"), items}; });
+    std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(8) << std::chrono::duration<double, std::milli>(after.t - before.t).count() << " ms  "
+              << "heap +" << std::setw(8) << after.heapKb - before.heapKb << " KiB  "
+              << "RssFile +" << std::setw(7) << after.fileKb - before.fileKb << " KiB  ("
+              << after.items << " items)\n";
+}
+
+static void sourceInput(size_t lines) {
+    const char* path = "rv32_bench_input.s";
+    size_t bytes = 0;
+    {
+        std::ofstream out(path, std::ios::binary);
+        std::string text = makeSource(lines);
+        bytes = text.size();
+        out << text;
+    }
+    std::cout << "--- Source input + tokenizePacked (" << bytes / 1024 << " KiB file) ---\n";
+    measureInput("readFile (ifstream copy)", [&](auto sample) {
+        std::string src = readFile(path);
+        sample(rv32::Lexer(src).tokenizePacked().size());
+    });
+    measureInput("SourceFile (mmap)", [&](auto sample) {
+        SourceFile src(path);
+        if (!src.isMapped()) std::cout << "  (mmap unavailable, read fallback)\n";
+        sample(rv32::Lexer(src.view()).tokenizePacked().size());
+    });
+
+    std::cout << "--- Full assembly, in memory vs. --stream ---\n";
+    measureInput("pass1/2Streaming", [&](auto sample) {
+        SourceFile src(path);
+        rv32::Assembler asmCore;
+        asmCore.pass1Streaming(src.view());
+        size_t words = 0;
+        uint32_t acc = 0;
+        asmCore.pass2Streaming(src.view(), [&](rv32::InstructionCode w) { ++words; acc ^= w; });
+        sink = acc;
+        sample(words);
+    });
+    measureInput("tokenizePacked + pass1/2", [&](auto sample) {
+        SourceFile src(path);
+        rv32::Assembler asmCore(rv32::Lexer(src.view()).tokenizePacked());
+        asmCore.pass1();
+        asmCore.pass2();
+        sample(asmCore.output().size());
+    });
+    std::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// Phase sweep: each phase of a file-to-hex run, timed on its own from 1k
+// instructions up, with what it allocates and the peak RSS while it runs
+// ---------------------------------------------------------------------------
+struct PhaseResult {
+    const char* phase;
+    size_t instructions, tokens, bytes; // bytes: source read, or hex written by export
+    double secs;
+    size_t allocations, allocatedBytes, peakRssKb;
+};
+
+// Restarts VmHWM from the current RSS (Linux 4.0+); elsewhere the peak only grows.
+static void resetPeakRss() {
+    std::ofstream clear("/proc/self/clear_refs");
+    if (clear) clear << "5";
+}
+
+static void phaseSweep(size_t maxInstructions, std::vector<PhaseResult>& results) {
+    static const char* const names[] = {"tokenize", "pass1", "pass2", "exportHex"};
+    const char* path = "rv32_bench_phases.hex";
+    std::cout << "--- Phases (best time, cold Assembler; allocations and peak RSS of one run) ---\n";
+    for (size_t target : {size_t(1000), size_t(10000), size_t(100000), size_t(1000000), size_t(10000000), size_t(50000000)}) {
+        if (target > maxInstructions) break;
+        const std::string src = makeSource(target * 10 / 8); // 8 in 10 lines are instructions
+        const size_t first = results.size();
+        // Small inputs repeat until the clock has something to measure.
+        const int reps = static_cast<int>(std::clamp<size_t>(2000000 / target, 1, 200));
+        for (int rep = 0; rep < reps; ++rep) {
+            const bool measure = rep == 0;
+            size_t allocs = 0, bytes = 0, peak = 0;
+            auto begin = [&] {
+                if (measure) resetPeakRss();
+                allocs = gAllocations;
+                bytes = gAllocatedBytes;
+                return Clock::now();
+            };
+            auto end = [&](int phase, Clock::time_point t0, size_t tokens, size_t instructions, size_t phaseBytes) {
+                const double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+                if (measure) {
+                    peak = statusKb("VmHWM");
+                    results.push_back({names[phase], instructions, tokens, phaseBytes, secs, gAllocations - allocs,
+                                       gAllocatedBytes - bytes, peak});
+                } else {
+                    PhaseResult& r = results[first + phase];
+                    r.secs = std::min(r.secs, secs);
+                }
+            };
+            rv32::TokenStream tokens;
+            auto t = begin();
+            rv32::Lexer(src).tokenizePacked(tokens);
+            const size_t tokenCount = tokens.size();
+            end(0, t, tokenCount, 0, src.size());
+            rv32::Assembler asmCore(std::move(tokens));
+            t = begin();
+            asmCore.pass1();
+            end(1, t, tokenCount, 0, src.size());
+            t = begin();
+            asmCore.pass2();
+            const size_t instructions = asmCore.output().size();
+            end(2, t, tokenCount, instructions, src.size());
+            std::streambuf* console = std::cout.rdbuf(nullptr); // mutes exportHex's [Info] line
+            t = begin();
+            asmCore.exportHex(path);
+            end(3, t, tokenCount, instructions, instructions * 9);
+            std::cout.rdbuf(console);
+        }
+        for (size_t i = first; i < results.size(); ++i) results[i].instructions = results[first + 2].instructions;
+    }
+    std::remove(path);
+
+    std::cout << std::left << std::setw(11) << "phase" << std::right << std::setw(10) << "instr" << std::setw(12) << "M tok/s"
+              << std::setw(12) << "M instr/s" << std::setw(10) << "MiB/s" << std::setw(10) << "allocs" << std::setw(12)
+              << "alloc KiB" << std::setw(12) << "peak KiB" << "\n";
+    for (const PhaseResult& r : results)
+        std::cout << std::left << std::setw(11) << r.phase << std::right << std::setw(10) << r.instructions << std::fixed
+                  << std::setprecision(1) << std::setw(12) << r.tokens / r.secs / 1e6 << std::setw(12)
+                  << r.instructions / r.secs / 1e6 << std::setw(10) << r.bytes / r.secs / (1 << 20) << std::setw(10)
+                  << r.allocations << std::setw(12) << r.allocatedBytes / 1024 << std::setw(12) << r.peakRssKb << "\n";
+}
+
+static void writePhasesJson(const char* path, const std::vector<PhaseResult>& results) {
+    std::ofstream out(path);
+    if (!out) throw std::runtime_error(std::string("Could not write ") + path);
+    out << "{\n  \"benchmark\": \"rv32_bench phases\",\n  \"fingerprint\": " << rv32::ISA::fingerprint()
+        << ",\n  \"encoder_revision\": " << rv32::kEncoderRevision << ",\n  \"results\": [\n";
+    out << std::setprecision(9);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const PhaseResult& r = results[i];
+        out << "    {\"phase\": \"" << r.phase << "\", \"instructions\": " << r.instructions << ", \"tokens\": " << r.tokens
+            << ", \"bytes\": " << r.bytes << ", \"seconds\": " << r.secs << ", \"tokens_per_s\": " << r.tokens / r.secs
+            << ", \"instructions_per_s\": " << r.instructions / r.secs << ", \"bytes_per_s\": " << r.bytes / r.secs
+            << ", \"allocations\": " << r.allocations << ", \"allocated_bytes\": " << r.allocatedBytes
+            << ", \"peak_rss_kb\": " << r.peakRssKb << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    std::cout << "[Info] Phase results written to " << path << "\n";
+}
+
+// ---------------------------------------------------------------------------
+// Image writers vs. the old per-word ofstream hex export
+// ---------------------------------------------------------------------------
+static void imageWriters(size_t lines) {
+    const std::string src = makeSource(lines);
+    auto t0 = Clock::now();
+    rv32::Assembler asmCore(rv32::Lexer(src).tokenizePacked());
+    asmCore.pass1();
+    asmCore.pass2();
+    const double assembleSecs = std::chrono::duration<double>(Clock::now() - t0).count();
+    const char* path = "rv32_bench_image.out";
+
+    std::cout << "--- Image writers (" << asmCore.output().size() << " words, % of assembly time) ---\n";
+    auto row = [&](const char* name, double secs, size_t bytes) {
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << secs * 1e3 << " ms" << std::setw(8) << 100.0 * secs / assembleSecs << " %"
+                  << std::setw(10) << bytes / 1024 << " KiB\n";
+    };
+    {
+        auto w0 = Clock::now();
+        std::ofstream out(path);
+        out << std::hex << std::setfill('0');
+        for (auto word : asmCore.output()) out << std::setw(8) << word << "\n";
+        out.close();
+        row("ofstream << setw (old)", std::chrono::duration<double>(Clock::now() - w0).count(), asmCore.output().size() * 9);
+    }
+    static const std::pair<const char*, rv32::ImageFormat> formats[] = {
+        {"hex", rv32::ImageFormat::Hex}, {"memh", rv32::ImageFormat::Memh}, {"ihex", rv32::ImageFormat::IntelHex},
+        {"bin", rv32::ImageFormat::Bin}, {"elf", rv32::ImageFormat::Elf},
+    };
+    rv32::ImageWriter writer; // one buffer shared by every format
+    for (const auto& [name, format] : formats) {
+        double secs = 1e30;
+        for (int rep = 0; rep < 3; ++rep) {
+            auto w0 = Clock::now();
+            writer.render(asmCore.image(), format);
+            writer.save(path);
+            secs = std::min(secs, std::chrono::duration<double>(Clock::now() - w0).count());
+        }
+        row((std::string("ImageWriter ") + name).c_str(), secs, writer.data().size());
+    }
+    std::remove(path);
+}
+
+// ---------------------------------------------------------------------------
+// Batch mode: many small inputs on the work-stealing pool
+// ---------------------------------------------------------------------------
+static void batchInputs(size_t files) {
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < files; ++i) sources.push_back(makeSource(40 + (i * 37) % 200));
+    const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "--- Batch (" << files << " small sources, " << hw << " workers) ---\n";
+    auto row = [&](const char* name, auto&& body) {
+        auto t0 = Clock::now();
+        std::atomic<size_t> words{0};
+        body(words);
+        double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << files / secs / 1e3 << " k files/s" << std::setw(10) << words / secs / 1e6 << " M instr/s\n";
+    };
+    row("fresh Assembler per file", [&](std::atomic<size_t>& words) {
+        rv32::detail::forEachStealing(files, hw, [&](unsigned, size_t i) {
+            rv32::Assembler asmCore(rv32::Lexer(sources[i]).tokenizePacked());
+            asmCore.pass1();
+            asmCore.pass2();
+            words += asmCore.output().size();
+        });
+    });
+    row("reused per-worker Assembler", [&](std::atomic<size_t>& words) {
+        std::vector<rv32::Assembler> workers(hw);
+        rv32::detail::forEachStealing(files, hw, [&](unsigned w, size_t i) {
+            workers[w].assemble(sources[i]);
+            words += workers[w].output().size();
+        });
+    });
+}
+
+// ---------------------------------------------------------------------------
+// Parallel assembly (-j N): scaling against the serial two-pass path
+// ---------------------------------------------------------------------------
+static void parallelScaling(size_t lines) {
+    const std::string src = makeSource(lines);
+    // Both sides include lexing.
+    auto t0 = Clock::now();
+    rv32::Assembler serial(rv32::Lexer(src).tokenizePacked());
+    serial.pass1();
+    serial.pass2();
+    const double serialSecs = std::chrono::duration<double>(Clock::now() - t0).count();
+    const size_t instructions = serial.output().size();
+
+    const unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+    std::cout << "--- Parallel assembly (" << instructions << " instructions, " << hw << " hardware threads) ---\n";
+    std::cout << std::left << std::setw(28) << "serial" << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << instructions / serialSecs / 1e6 << " M instr/s\n";
+    for (unsigned jobs = 1; jobs <= std::max(hw, 4u); jobs *= 2) {
+        double secs = 1e30;
+        for (int rep = 0; rep < 3; ++rep) {
+            rv32::Assembler par;
+            auto p0 = Clock::now();
+            par.assembleParallel(src, jobs);
+            secs = std::min(secs, std::chrono::duration<double>(Clock::now() - p0).count());
+            if (par.output() != serial.output()) throw std::runtime_error("Parallel output differs from serial");
+        }
+        std::string name = "-j " + std::to_string(jobs);
+        std::cout << std::left << std::setw(28) << name << std::right << std::setw(10) << instructions / secs / 1e6
+                  << " M instr/s  x" << std::setprecision(2) << serialSecs / secs << std::setprecision(1) << "\n";
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Erroneous sources: every mode must recover alike
+// ---------------------------------------------------------------------------
+// Short programs from well-formed lines, then mutated: characters dropped,
+// stray tokens and line breaks inserted. Deterministic, so a divergence
+// reproduces. Labels are few, so duplicates and undefined ones are common.
+static std::string makeMutant(std::mt19937& rng) {
+    static const char* const lines[] = {
+        "lw a0, 4(sp)", "sw ra, -8(s0)", "la t0, foo", "foo:", "bar:", "li t1, -1", "li t2, 0x12345",
+        "beq x1, x2, foo", "j bar", "call foo", "add x1, x2, x3", "lui x5, 0x1000", "jal ra, bar",
+        ".org 0x100", "nop", "ret", "bnez a0, foo", "slli x1, x1, 3", "jalr x0, 0(ra)", "neg a0, a1",
+        "jal foo", "jalr a0", "lw a1, bar", "sb a2, foo, t0",
+    };
+    static const char* const junk[] = {",", "(", ")", "x1", "5", "foo", "foo:", "lw", "\n", "9999", ".org"};
+    std::string src;
+    for (size_t n = 1 + rng() % 12; n > 0; --n) {
+        src += lines[rng() % (sizeof(lines) / sizeof(lines[0]))];
+        src += '\n';
+    }
+    for (size_t n = rng() % 4; n > 0 && !src.empty(); --n) {
+        const size_t at = rng() % src.size();
+        if (rng() % 2) src.erase(at, 1 + rng() % 3);
+        else src.insert(at, std::string(" ") + junk[rng() % (sizeof(junk) / sizeof(junk[0]))] + " ");
+    }
+    return src;
+}
+
+// What a run produced: its diagnostics and how many words it placed. The
+// words themselves are only meaningful when there are no diagnostics.
+struct Outcome {
+    bool threw = false;
+    std::vector<rv32::Diagnostic> diags;
+    std::vector<rv32::InstructionCode> words;
+};
+
+template <typename Run>
+static Outcome outcome(Run&& run) {
+    Outcome o;
+    rv32::Assembler asmCore;
+    try {
+        run(asmCore, o.words);
+        o.diags = asmCore.diagnostics();
+        if (o.words.empty()) o.words = asmCore.output();
+    } catch (const std::exception&) {
+        o.threw = true; // lexical errors throw in every mode
+    }
+    return o;
+}
+
+static bool sameOutcome(const Outcome& a, const Outcome& b) {
+    if (a.threw || b.threw) return a.threw == b.threw;
+    if (a.words.size() != b.words.size() || a.diags.size() != b.diags.size()) return false;
+    for (size_t i = 0; i < a.diags.size(); ++i)
+        if (a.diags[i].line != b.diags[i].line || a.diags[i].message != b.diags[i].message) return false;
+    return !a.diags.empty() || a.words == b.words;
+}
+
+static void erroneousSources(size_t sources) {
+    using Words = std::vector<rv32::InstructionCode>;
+    std::mt19937 rng(2024);
+    size_t failing = 0;
+    auto t0 = Clock::now();
+    for (size_t i = 0; i < sources; ++i) {
+        const std::string src = makeMutant(rng);
+        const Outcome serial = outcome([&](rv32::Assembler& a, Words&) { a.assemble(src); });
+        failing += !serial.threw && !serial.diags.empty();
+        const std::pair<const char*, Outcome> modes[] = {
+            {"assembleOnePass(source)", outcome([&](rv32::Assembler& a, Words&) { a.assembleOnePass(src); })},
+            {"pass1/2Streaming", outcome([&](rv32::Assembler& a, Words& w) {
+                 a.pass1Streaming(src);
+                 a.pass2Streaming(src, [&](rv32::InstructionCode word) { w.push_back(word); });
+             })},
+            {"assembleParallel(2)", outcome([&](rv32::Assembler& a, Words&) { a.assembleParallel(src, 2); })},
+            {"assembleParallel(5)", outcome([&](rv32::Assembler& a, Words&) { a.assembleParallel(src, 5); })},
+        };
+        for (const auto& [name, o] : modes)
+            if (!sameOutcome(serial, o)) throw std::runtime_error(std::string(name) + " differs from two-pass on:\n" + src);
+    }
+    const double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    std::cout << "--- Erroneous sources (" << sources << " mutants, " << failing << " with diagnostics) ---\n";
+    std::cout << std::left << std::setw(28) << "all modes agree" << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << sources / secs / 1e3 << " k sources/s\n";
+}
+
+// The second syntaxes of jal, jalr, loads and stores, with llvm-mc's words
+// (-mattr=-c,-relax), in every mode and at compile time.
+static constexpr std::string_view kSecondSyntaxes = R"(start:
+    jal foo
+    jalr a0
+    lw a0, foo
+    lbu s1, start
+    sw a1, foo, t0
+    sb s2, start, t6
+    nop
+foo:
+    lh a2, foo
+    sh a5, start, t1
+)";
+static constexpr rv32::InstructionCode kSecondSyntaxWords[] = {
+    0x02C000EF, 0x000500E7, 0x00000517, 0x02452503, 0x00000497, 0xFF04C483, 0x00000297, 0x00B2AA23,
+    0x00000F97, 0xFF2F8023, 0x00000013, 0x00000617, 0x00061603, 0x00000317, 0xFCF31623,
+};
+#if defined(__cpp_lib_is_constant_evaluated) // the Lexer runs in constant expressions from C++20
+static_assert(rv32::ConstAssembler::assemble<15, 2>(kSecondSyntaxes).words[14] == 0xFCF31623, "sh a5, start, t1");
+#endif
+
+static void secondSyntaxes() {
+    using Words = std::vector<rv32::InstructionCode>;
+    const std::string src(kSecondSyntaxes);
+    const Words expect(std::begin(kSecondSyntaxWords), std::end(kSecondSyntaxWords));
+    rv32::IncrementalAssembler inc;
+    const std::pair<const char*, Outcome> modes[] = {
+        {"assemble(source)", outcome([&](rv32::Assembler& a, Words&) { a.assemble(src); })},
+        {"assembleOnePass(source)", outcome([&](rv32::Assembler& a, Words&) { a.assembleOnePass(src); })},
+        {"pass1/2Streaming", outcome([&](rv32::Assembler& a, Words& w) {
+             a.pass1Streaming(src);
+             a.pass2Streaming(src, [&](rv32::InstructionCode word) { w.push_back(word); });
+         })},
+        {"assembleParallel(3)", outcome([&](rv32::Assembler& a, Words&) { a.assembleParallel(src, 3); })},
+        {"IncrementalAssembler", outcome([&](rv32::Assembler&, Words& w) {
+             inc.update(std::string(src).insert(src.find("foo:"), "    nop\n"));
+             if (inc.update(src).full) throw std::runtime_error("Unexpected full reassembly");
+             w = inc.output();
+         })},
+    };
+    for (const auto& [name, o] : modes)
+        if (o.threw || !o.diags.empty() || o.words != expect) throw std::runtime_error(std::string(name) + " differs from llvm-mc on the second syntaxes");
+    std::cout << "--- Second syntaxes (" << expect.size() << " words) ---\n";
+    std::cout << std::left << std::setw(28) << "match llvm-mc in all modes" << "\n";
+}
+
+#if RV32_HAVE_UNIX_SOCKETS
+// ---------------------------------------------------------------------------
+// --serve: request latency over the Unix socket, client in this process
+// ---------------------------------------------------------------------------
+static void serverLatency(size_t requests) {
+    const std::string path = "/tmp/rv32_bench_" + std::to_string(::getpid()) + ".sock";
+    AsmServer server(path);
+    std::thread loop([&] { server.serve(); });
+
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::copy(path.begin(), path.end(), addr.sun_path);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) throw std::runtime_error("connect failed");
+
+    const std::string src = makeSource(64); // a typical generated test
+    rv32::Assembler local;
+    local.assemble(src);
+    std::string request(4, '\0'), expected, reply;
+    for (int i = 0; i < 4; ++i) request[i] = char(src.size() >> (8 * i));
+    request += src;
+    AsmServer::encodeReply(local, expected);
+
+    std::vector<double> micros;
+    micros.reserve(requests);
+    for (size_t r = 0; r < requests; ++r) {
+        auto t0 = Clock::now();
+        if (::send(fd, request.data(), request.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(request.size()))
+            throw std::runtime_error("send failed");
+        reply.resize(expected.size());
+        size_t got = 0;
+        while (got < reply.size()) {
+            ssize_t n = ::read(fd, &reply[got], reply.size() - got);
+            if (n <= 0) throw std::runtime_error("server closed the connection");
+            got += static_cast<size_t>(n);
+        }
+        micros.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+        if (reply != expected) throw std::runtime_error("Server reply differs from in-process assembly");
+    }
+    ::close(fd);
+    server.stop();
+    loop.join();
+
+    std::sort(micros.begin(), micros.end());
+    double total = 0;
+    for (double m : micros) total += m;
+    std::cout << "--- Server round trip (" << requests << " requests, " << local.output().size() << " words each) ---\n"
+              << std::fixed << std::setprecision(1)
+              << std::left << std::setw(28) << "p50" << std::right << std::setw(10) << micros[micros.size() / 2] << " us\n"
+              << std::left << std::setw(28) << "p99" << std::right << std::setw(10) << micros[micros.size() * 99 / 100] << " us\n"
+              << std::left << std::setw(28) << "max" << std::right << std::setw(10) << micros.back() << " us\n"
+              << std::left << std::setw(28) << "throughput" << std::right << std::setw(10) << requests / (total / 1e6) / 1e3 << " k req/s\n";
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// --watch: one-line edits through IncrementalAssembler vs. a full reassembly
+// ---------------------------------------------------------------------------
+static void incrementalEdits(size_t lines) {
+    const std::string base = makeSource(lines);
+    const size_t at = base.find("addi x1, x0, 10\n", base.size() / 2) + 14;
+    std::string operand = base;
+    operand[at] = '1'; // 10 -> 11
+    std::string insert = base;
+    insert.insert(at + 3, "    add  x5, x6, x7\n"); // an instruction midway: half the image moves
+    std::cout << "--- Incremental edits (" << lines << " lines) ---\n";
+    rv32::IncrementalAssembler inc;
+    inc.update(base);
+    auto row = [&](const char* name, const std::string& from, const std::string& to) {
+        std::vector<double> us;
+        size_t rewritten = 0;
+        for (int r = 0; r < 51; ++r) {
+            inc.update(from);
+            std::string text = to; // copied outside the timing, as the driver reads it
+            auto t0 = Clock::now();
+            const auto& d = inc.update(std::move(text));
+            us.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+            if (d.full) throw std::runtime_error("Unexpected full reassembly");
+            rewritten = d.rewritten.size();
+        }
+        std::sort(us.begin(), us.end());
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << us[us.size() / 2] << " us median" << std::setw(8) << rewritten << " rewritten\n";
+    };
+    row("no change", base, base);
+    row("edit an operand", base, operand);
+    row("insert a line", base, insert);
+    row("delete a line", insert, base);
+
+    rv32::Assembler asmCore;
+    asmCore.assemble(base); // warm, like the incremental rows
+    auto t0 = Clock::now();
+    asmCore.assemble(base);
+    const double us = std::chrono::duration<double, std::micro>(Clock::now() - t0).count();
+    if (asmCore.output() != inc.output()) throw std::runtime_error("Incremental output differs");
+    std::cout << std::left << std::setw(28) << "full reassembly" << std::right << std::setw(10) << us << " us\n";
+}
+
+#if RV32_HAVE_MMAP
+// ---------------------------------------------------------------------------
+// --cache: hit vs. miss vs. no cache on many small unchanged sources
+// ---------------------------------------------------------------------------
+static void imageCache(size_t files) {
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < files; ++i) // distinct bytes, so every file has its own entry
+        sources.push_back("# file " + std::to_string(i) + "\n" + makeSource(40 + (i * 37) % 200));
+    const std::string big = makeSource(1000000);
+    const std::string dir = "/tmp/rv32_bench_cache_" + std::to_string(::getpid());
+    std::cout << "--- Image cache (" << files << " small sources, one thread) ---\n";
+    auto row = [&](const char* name, auto&& body) {
+        auto t0 = Clock::now();
+        size_t words = body();
+        double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(1)
+                  << std::setw(10) << files / secs / 1e3 << " k files/s" << std::setw(10) << words / secs / 1e6 << " M instr/s\n";
+    };
+    {
+        ImageCache cache(dir, uint64_t(1) << 30);
+        ImageCache::Entry entry;
+        rv32::Assembler asmCore;
+        row("no cache (reused Assembler)", [&] {
+            size_t words = 0;
+            for (const std::string& src : sources) { asmCore.assemble(src); words += asmCore.output().size(); }
+            return words;
+        });
+        row("miss: assemble + store", [&] {
+            size_t words = 0;
+            for (const std::string& src : sources) {
+                if (cache.lookup(src, entry)) throw std::runtime_error("Unexpected cache hit");
+                asmCore.assemble(src);
+                cache.store(src, asmCore);
+                words += asmCore.output().size();
+            }
+            return words;
+        });
+        row("hit: hash + map", [&] {
+            size_t words = 0;
+            for (const std::string& src : sources) {
+                if (!cache.lookup(src, entry)) throw std::runtime_error("Unexpected cache miss");
+                for (const rv32::ImageSegment& seg : entry.image()) words += seg.count;
+            }
+            return words;
+        });
+    }
+    std::filesystem::remove_all(dir);
+
+    auto t0 = Clock::now();
+    const uint64_t k = ImageCache::key(big);
+    const double secs = std::chrono::duration<double>(Clock::now() - t0).count();
+    sink = static_cast<uint32_t>(k);
+    std::cout << std::left << std::setw(28) << "xxh64 key" << std::right << std::setw(10)
+              << big.size() / secs / (1 << 30) << " GiB/s\n";
+}
+#endif
+
+} // namespace bench
+
+int main(int argc, char** argv) {
+    size_t iterations = 200000, maxInstructions = 10000000;
+    const char* json = nullptr;
+    bool phasesOnly = false;
+    for (int a = 1; a < argc; ++a) {
+        std::string_view arg(argv[a]);
+        if (arg == "--phases") phasesOnly = true;
+        else if (arg == "--json" && a + 1 < argc) json = argv[++a];
+        else if (arg == "--max-instructions" && a + 1 < argc) maxInstructions = std::stoul(argv[++a]);
+        else iterations = std::stoul(argv[a]);
+    }
+    std::vector<bench::PhaseResult> phases;
+    bench::phaseSweep(maxInstructions, phases);
+    if (json) bench::writePhasesJson(json, phases);
+    if (phasesOnly) return 0;
+    bench::isaLookups(iterations);
+    bench::symbolTables(2000000);
+    bench::lexerPaths(iterations * 5);
+    bench::tokenStorage(iterations * 5);
+    bench::assemblerThroughput(1000000 * 10 / 8); // ~1M instructions
+    bench::batchEncoding(1 << 20);
+    bench::programGeneration(1000000);
+    bench::imageWriters(1000000 * 10 / 8);
+    bench::parallelScaling(1000000 * 10 / 8);
+    bench::erroneousSources(20000);
+    bench::secondSyntaxes();
+    bench::batchInputs(20000);
+    bench::incrementalEdits(100000);
+#if RV32_HAVE_UNIX_SOCKETS
+    bench::serverLatency(20000);
+#endif
+#if RV32_HAVE_MMAP
+    bench::imageCache(5000);
+#endif
+    bench::sourceInput(4000000);
+    return 0;
+}
@@ -0,0 +1,334 @@
+// rv32_emit.hpp
+// Programmatic code emission: build RV32I programs from C++ calls instead of
+// assembly text. Every call encodes straight into a word buffer through the
+// ISA table's format encoders, so nothing is printed, lexed or looked up:
+//
+//   using namespace rv32::regs;
+//   rv32::CodeBuffer code;
+//   rv32::Emitter e(code);
+//   auto loop = e.newLabel();
+//   e.addi(x1, x0, 10);
+//   e.bind(loop);
+//   e.addi(x1, x1, -1);
+//   e.bne(x1, x0, loop);
+//   const auto& words = code.finalize();
+//
+// Branches and jumps to labels not bound yet are encoded with offset 0 and
+// patched by finalize(). The words match what the Assembler produces for the
+// same program as text, and what it rejects as out of range throws
+// std::runtime_error here. Header-only, standard library only.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "rv32_isa.hpp"
+
+namespace rv32 {
+
+using Address = uint32_t;
+
+struct Reg {
+    uint8_t n;
+};
+
+// Register operands by number and by ABI name. Kept in their own namespace:
+// `using namespace rv32::regs` brings in 67 short names.
+namespace regs {
+inline constexpr Reg x0{0}, x1{1}, x2{2}, x3{3}, x4{4}, x5{5}, x6{6}, x7{7}, x8{8}, x9{9}, x10{10}, x11{11},
+    x12{12}, x13{13}, x14{14}, x15{15}, x16{16}, x17{17}, x18{18}, x19{19}, x20{20}, x21{21}, x22{22}, x23{23},
+    x24{24}, x25{25}, x26{26}, x27{27}, x28{28}, x29{29}, x30{30}, x31{31};
+inline constexpr Reg zero{0}, ra{1}, sp{2}, gp{3}, tp{4}, t0{5}, t1{6}, t2{7}, s0{8}, fp{8}, s1{9},
+    a0{10}, a1{11}, a2{12}, a3{13}, a4{14}, a5{15}, a6{16}, a7{17},
+    s2{18}, s3{19}, s4{20}, s5{21}, s6{22}, s7{23}, s8{24}, s9{25}, s10{26}, s11{27},
+    t3{28}, t4{29}, t5{30}, t6{31};
+} // namespace regs
+
+// A position in a CodeBuffer, bound once with bind().
+struct Label {
+    uint32_t id;
+};
+
+// The words of one program, its labels and the references to labels that
+// were not bound yet when the referring word was written. Addresses start
+// at `base`; there is no .org.
+class CodeBuffer {
+    friend class Emitter;
+
+    static constexpr uint32_t kUnbound = UINT32_MAX;
+
+    struct Fixup {
+        size_t word;    // index into words of the instruction's first word
+        uint32_t label;
+        InstrType type; // B_TYPE, J_TYPE, or U_TYPE for an auipc pair (see ISA::retarget)
+    };
+
+    std::vector<InstructionCode> words;
+    std::vector<uint32_t> bound; // word index per label, or kUnbound
+    std::vector<Fixup> fixups;
+    Address base;
+
+    // PC-relative offset from word `at` to `target`, both word indices.
+    static int32_t offset(size_t at, uint32_t target) {
+        return static_cast<int32_t>((static_cast<int64_t>(target) - static_cast<int64_t>(at)) * 4);
+    }
+
+    // `offset`, if the field of a `type` reference holds it (ISA::reaches).
+    static int32_t reachable(InstrType type, int32_t offset) {
+        if (!ISA::reaches(type, offset))
+            throw std::runtime_error(std::string(type == InstrType::B_TYPE ? "Branch" : "Jump") + " target out of range: " +
+                                     std::to_string(offset));
+        return offset;
+    }
+
+public:
+    explicit CodeBuffer(Address base = 0) : base(base) {}
+
+    // Drops every word, label and pending reference; capacity is kept, so one
+    // buffer serves any number of generated programs without allocating.
+    void clear() {
+        words.clear();
+        bound.clear();
+        fixups.clear();
+    }
+    void reserve(size_t instructions) { words.reserve(instructions); }
+
+    Label newLabel() {
+        bound.push_back(kUnbound);
+        return {static_cast<uint32_t>(bound.size() - 1)};
+    }
+
+    // Places `label` at the next word to be written.
+    void bind(Label label) {
+        if (label.id >= bound.size()) throw std::runtime_error("Label from another buffer");
+        if (bound[label.id] != kUnbound) throw std::runtime_error("Label bound twice");
+        bound[label.id] = static_cast<uint32_t>(words.size());
+    }
+
+    bool isBound(Label label) const { return label.id < bound.size() && bound[label.id] != kUnbound; }
+    Address addressOf(Label label) const {
+        if (label.id >= bound.size()) throw std::runtime_error("Label from another buffer");
+        if (bound[label.id] == kUnbound) throw std::runtime_error("Unbound label");
+        return base + 4 * bound[label.id];
+    }
+    Address pc() const { return base + static_cast<Address>(4 * words.size()); }
+    size_t size() const { return words.size(); }
+
+    // Patches every forward reference and returns the program. Throws if a
+    // referenced label was never bound or is out of the reference's reach.
+    // Emission may continue afterwards.
+    const std::vector<InstructionCode>& finalize() {
+        for (const Fixup& f : fixups) {
+            const uint32_t target = bound[f.label];
+            if (target == kUnbound) throw std::runtime_error("Unbound label");
+            ISA::retarget(&words[f.word], f.type, reachable(f.type, offset(f.word, target)));
+        }
+        fixups.clear();
+        return words;
+    }
+
+    // The words so far; forward references read as 0 until finalize().
+    const std::vector<InstructionCode>& code() const { return words; }
+};
+
+// Writes instructions into a CodeBuffer, one method per mnemonic of the ISA
+// table, operands in assembly order. Each method's definition index is a
+// template argument, resolved at compile time, so a call is the format
+// encoder and a push_back. Generators that pick instructions from the table
+// use emit(index, ...) instead. Immediates are range-checked as the
+// Assembler checks them in text, and throw rather than being masked; lui
+// takes the upper 20 bits. and, or, xor and not are C++ keywords, so those
+// four carry a trailing underscore.
+class Emitter {
+    CodeBuffer& buf;
+
+    template <int Index>
+    static constexpr const InstructionDef& def() {
+        static_assert(Index >= 0, "mnemonic missing from the ISA table");
+        return ISA::defAt(Index);
+    }
+
+    template <InstrType Type>
+    void put(const InstructionDef& d, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm) {
+        buf.words.push_back(ISA::encode<Type>(d, rd, rs1, rs2, imm));
+    }
+
+    // Offset to `target` from the word about to be written, or 0 and a fixup.
+    int32_t reach(Label target, InstrType type) {
+        const size_t at = buf.words.size();
+        if (target.id >= buf.bound.size()) throw std::runtime_error("Label from another buffer");
+        const uint32_t to = buf.bound[target.id];
+        if (to != CodeBuffer::kUnbound) return CodeBuffer::reachable(type, CodeBuffer::offset(at, to));
+        buf.fixups.push_back({at, target.id, type});
+        return 0;
+    }
+
+    // `imm`, if it lies in [lo, hi].
+    static int32_t bounded(int32_t imm, int32_t lo, int32_t hi) {
+        if (imm < lo || imm > hi) throw std::runtime_error("Immediate out of range: " + std::to_string(imm));
+        return imm;
+    }
+
+    // The immediate of an I-type word: a shift amount, or 12 bits signed.
+    static int32_t immI(const InstructionDef& d, int32_t imm) {
+        return d.operands == Operands::RdRs1Shamt ? bounded(imm, 0, 31) : bounded(imm, -2048, 2047);
+    }
+
+    // Checks the immediate emit(index, ...) passes, by the format it fills.
+    static void checkImm(int index, int32_t imm) {
+        const InstructionDef& d = ISA::defAt(index);
+        switch (ISA::format(index)) {
+        case InstrType::I_TYPE:
+            if (d.type != InstrType::PSEUDO) immI(d, imm); // a pseudo's immediate is implied
+            break;
+        case InstrType::S_TYPE: bounded(imm, -2048, 2047); break;
+        case InstrType::B_TYPE:
+        case InstrType::J_TYPE:
+            if (imm % 2 != 0)
+                throw std::runtime_error(std::string(ISA::format(index) == InstrType::B_TYPE ? "Branch" : "Jump") + " offset must be even");
+            CodeBuffer::reachable(ISA::format(index), imm);
+            break;
+        case InstrType::U_TYPE:
+            if (imm & 0xFFF) throw std::runtime_error("Immediate out of range: " + std::to_string(imm));
+            break;
+        default: break; // R-type, and sequences, which take any value or offset
+        }
+    }
+
+    template <int I> void r(Reg rd, Reg rs1, Reg rs2) { put<InstrType::R_TYPE>(def<I>(), rd.n, rs1.n, rs2.n, 0); }
+    template <int I> void i(Reg rd, Reg rs1, int32_t imm) { put<InstrType::I_TYPE>(def<I>(), rd.n, rs1.n, 0, immI(def<I>(), imm)); }
+    template <int I> void s(Reg rs2, int32_t off, Reg rs1) {
+        put<InstrType::S_TYPE>(def<I>(), 0, rs1.n, rs2.n, bounded(off, -2048, 2047));
+    }
+    template <int I> void b(Reg rs1, Reg rs2, Label l) {
+        put<InstrType::B_TYPE>(def<I>(), 0, rs1.n, rs2.n, reach(l, InstrType::B_TYPE));
+    }
+    template <int I> void u(Reg rd, uint32_t imm20) {
+        if (imm20 > 0xFFFFF) throw std::runtime_error("Immediate out of range: " + std::to_string(imm20));
+        put<InstrType::U_TYPE>(def<I>(), rd.n, 0, 0, static_cast<int32_t>(imm20 << 12));
+    }
+    template <int I> void p(Reg rd, Reg rs1, Reg rs2 = regs::x0) { put<InstrType::PSEUDO>(def<I>(), rd.n, rs1.n, rs2.n, 0); }
+    template <int I> void pb(Reg rs1, Reg rs2, Label l) {
+        put<InstrType::PSEUDO>(def<I>(), 0, rs1.n, rs2.n, reach(l, InstrType::B_TYPE));
+    }
+    // A sequence; `imm` is li's value or the label's offset from the first word.
+    template <int I> void seq(Reg rd, Reg rs1, int32_t imm) {
+        InstructionCode w[ISA::kMaxWords] = {};
+        const int n = ISA::expand(I, rd.n, rs1.n, 0, imm, w);
+        buf.words.insert(buf.words.end(), w, w + n);
+    }
+
+public:
+    explicit Emitter(CodeBuffer& code) : buf(code) {}
+
+    Label newLabel() { return buf.newLabel(); }
+    void bind(Label label) { buf.bind(label); }
+    const std::vector<InstructionCode>& finalize() { return buf.finalize(); }
+
+    // Definition `index` from operand values: registers and the immediate as
+    // the format reads them (lui: the full value, low 12 bits clear), as
+    // ISA::expand takes them. Throws if the immediate does not fit.
+    void emit(int index, Reg rd, Reg rs1, Reg rs2, int32_t imm) {
+        checkImm(index, imm);
+        InstructionCode w[ISA::kMaxWords] = {};
+        const int n = ISA::expand(index, rd.n, rs1.n, rs2.n, imm, w);
+        buf.words.insert(buf.words.end(), w, w + n);
+    }
+    // A branch (rs1, rs2), jump (rd), or la/call/tail definition `index` to
+    // `target`. Registers a pseudo-instruction implies are the caller's to pass.
+    void emit(int index, Reg rd, Reg rs1, Reg rs2, Label target) {
+        const bool pair = ISA::isSequence(ISA::defAt(index)) && ISA::defAt(index).operands != Operands::RdValue;
+        const InstrType type = pair ? InstrType::U_TYPE : ISA::format(index);
+        if (type != InstrType::B_TYPE && type != InstrType::J_TYPE && !pair)
+            throw std::runtime_error("Label operand on an instruction that takes none");
+        emit(index, rd, rs1, rs2, reach(target, type));
+    }
+
+    // R-Type
+    void add(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("add")>(rd, rs1, rs2); }
+    void sub(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("sub")>(rd, rs1, rs2); }
+    void xor_(Reg rd, Reg rs1, Reg rs2) { r<ISA::getDefIndex("xor")>(rd, rs1, rs2); }
+    void or_(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("or")>(rd, rs1, rs2); }
+    void and_(Reg rd, Reg rs1, Reg rs2) { r<ISA::getDefIndex("and")>(rd, rs1, rs2); }
+    void sll(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("sll")>(rd, rs1, rs2); }
+    void srl(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("srl")>(rd, rs1, rs2); }
+    void sra(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("sra")>(rd, rs1, rs2); }
+    void slt(Reg rd, Reg rs1, Reg rs2)  { r<ISA::getDefIndex("slt")>(rd, rs1, rs2); }
+    void sltu(Reg rd, Reg rs1, Reg rs2) { r<ISA::getDefIndex("sltu")>(rd, rs1, rs2); }
+
+    // I-Type; loads and jalr in assembly order: lw(rd, off, rs1) is lw rd, off(rs1)
+    void addi(Reg rd, Reg rs1, int32_t imm)  { i<ISA::getDefIndex("addi")>(rd, rs1, imm); }
+    void xori(Reg rd, Reg rs1, int32_t imm)  { i<ISA::getDefIndex("xori")>(rd, rs1, imm); }
+    void ori(Reg rd, Reg rs1, int32_t imm)   { i<ISA::getDefIndex("ori")>(rd, rs1, imm); }
+    void andi(Reg rd, Reg rs1, int32_t imm)  { i<ISA::getDefIndex("andi")>(rd, rs1, imm); }
+    void slli(Reg rd, Reg rs1, int32_t sh)   { i<ISA::getDefIndex("slli")>(rd, rs1, sh); }
+    void srli(Reg rd, Reg rs1, int32_t sh)   { i<ISA::getDefIndex("srli")>(rd, rs1, sh); }
+    void srai(Reg rd, Reg rs1, int32_t sh)   { i<ISA::getDefIndex("srai")>(rd, rs1, sh); }
+    void slti(Reg rd, Reg rs1, int32_t imm)  { i<ISA::getDefIndex("slti")>(rd, rs1, imm); }
+    void sltiu(Reg rd, Reg rs1, int32_t imm) { i<ISA::getDefIndex("sltiu")>(rd, rs1, imm); }
+    void lb(Reg rd, int32_t off, Reg rs1)    { i<ISA::getDefIndex("lb")>(rd, rs1, off); }
+    void lh(Reg rd, int32_t off, Reg rs1)    { i<ISA::getDefIndex("lh")>(rd, rs1, off); }
+    void lw(Reg rd, int32_t off, Reg rs1)    { i<ISA::getDefIndex("lw")>(rd, rs1, off); }
+    void lbu(Reg rd, int32_t off, Reg rs1)   { i<ISA::getDefIndex("lbu")>(rd, rs1, off); }
+    void lhu(Reg rd, int32_t off, Reg rs1)   { i<ISA::getDefIndex("lhu")>(rd, rs1, off); }
+    void jalr(Reg rd, Reg rs1, int32_t imm)  { i<ISA::getDefIndex("jalr")>(rd, rs1, imm); }
+
+    // S-Type: sw(rs2, off, rs1) is sw rs2, off(rs1)
+    void sb(Reg rs2, int32_t off, Reg rs1) { s<ISA::getDefIndex("sb")>(rs2, off, rs1); }
+    void sh(Reg rs2, int32_t off, Reg rs1) { s<ISA::getDefIndex("sh")>(rs2, off, rs1); }
+    void sw(Reg rs2, int32_t off, Reg rs1) { s<ISA::getDefIndex("sw")>(rs2, off, rs1); }
+
+    // B-Type
+    void beq(Reg rs1, Reg rs2, Label l)  { b<ISA::getDefIndex("beq")>(rs1, rs2, l); }
+    void bne(Reg rs1, Reg rs2, Label l)  { b<ISA::getDefIndex("bne")>(rs1, rs2, l); }
+    void blt(Reg rs1, Reg rs2, Label l)  { b<ISA::getDefIndex("blt")>(rs1, rs2, l); }
+    void bge(Reg rs1, Reg rs2, Label l)  { b<ISA::getDefIndex("bge")>(rs1, rs2, l); }
+    void bltu(Reg rs1, Reg rs2, Label l) { b<ISA::getDefIndex("bltu")>(rs1, rs2, l); }
+    void bgeu(Reg rs1, Reg rs2, Label l) { b<ISA::getDefIndex("bgeu")>(rs1, rs2, l); }
+
+    // U-Type
+    void lui(Reg rd, uint32_t imm20)   { u<ISA::getDefIndex("lui")>(rd, imm20); }
+    void auipc(Reg rd, uint32_t imm20) { u<ISA::getDefIndex("auipc")>(rd, imm20); }
+
+    // J-Type
+    void jal(Reg rd, Label l) {
+        put<InstrType::J_TYPE>(def<ISA::getDefIndex("jal")>(), rd.n, 0, 0, reach(l, InstrType::J_TYPE));
+    }
+
+    // Pseudo-Instructions
+    void nop()                { p<ISA::getDefIndex("nop")>(regs::x0, regs::x0); }
+    void mv(Reg rd, Reg rs)   { p<ISA::getDefIndex("mv")>(rd, rs); }
+    void not_(Reg rd, Reg rs) { p<ISA::getDefIndex("not")>(rd, rs); }
+    void neg(Reg rd, Reg rs)  { p<ISA::getDefIndex("neg")>(rd, regs::x0, rs); }
+    void seqz(Reg rd, Reg rs) { p<ISA::getDefIndex("seqz")>(rd, rs); }
+    void snez(Reg rd, Reg rs) { p<ISA::getDefIndex("snez")>(rd, regs::x0, rs); }
+    void sltz(Reg rd, Reg rs) { p<ISA::getDefIndex("sltz")>(rd, rs); }
+    void sgtz(Reg rd, Reg rs) { p<ISA::getDefIndex("sgtz")>(rd, regs::x0, rs); }
+    void beqz(Reg rs, Label l) { pb<ISA::getDefIndex("beqz")>(rs, regs::x0, l); }
+    void bnez(Reg rs, Label l) { pb<ISA::getDefIndex("bnez")>(rs, regs::x0, l); }
+    void blez(Reg rs, Label l) { pb<ISA::getDefIndex("blez")>(regs::x0, rs, l); }
+    void bgez(Reg rs, Label l) { pb<ISA::getDefIndex("bgez")>(rs, regs::x0, l); }
+    void bltz(Reg rs, Label l) { pb<ISA::getDefIndex("bltz")>(rs, regs::x0, l); }
+    void bgtz(Reg rs, Label l) { pb<ISA::getDefIndex("bgtz")>(regs::x0, rs, l); }
+    void bgt(Reg rs, Reg rt, Label l)  { pb<ISA::getDefIndex("bgt")>(rt, rs, l); }
+    void ble(Reg rs, Reg rt, Label l)  { pb<ISA::getDefIndex("ble")>(rt, rs, l); }
+    void bgtu(Reg rs, Reg rt, Label l) { pb<ISA::getDefIndex("bgtu")>(rt, rs, l); }
+    void bleu(Reg rs, Reg rt, Label l) { pb<ISA::getDefIndex("bleu")>(rt, rs, l); }
+    void j(Label l) {
+        put<InstrType::PSEUDO>(def<ISA::getDefIndex("j")>(), 0, 0, 0, reach(l, InstrType::J_TYPE));
+    }
+    void jr(Reg rs) { p<ISA::getDefIndex("jr")>(regs::x0, rs); }
+    void ret()      { p<ISA::getDefIndex("ret")>(regs::x0, regs::ra); }
+
+    // Sequences: li picks the shortest, as the Assembler does
+    void li(Reg rd, int32_t value) { seq<ISA::getDefIndex("li")>(rd, regs::x0, value); }
+    void la(Reg rd, Label l)       { seq<ISA::getDefIndex("la")>(rd, rd, reach(l, InstrType::U_TYPE)); }
+    void call(Label l)             { seq<ISA::getDefIndex("call")>(regs::ra, regs::ra, reach(l, InstrType::U_TYPE)); }
+    void tail(Label l)             { seq<ISA::getDefIndex("tail")>(regs::x0, regs::t1, reach(l, InstrType::U_TYPE)); }
+};
+
+} // namespace rv32
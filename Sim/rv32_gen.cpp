@@ -0,0 +1,314 @@
+// rv32_gen.cpp
+// Synthetic RV32I programs in this assembler's dialect: the standard workload
+// for assembler and simulator performance work. Output depends only on the
+// options and the seed, and streams to stdout in constant memory.
+// g++ -std=c++17 -O2 rv32_gen.cpp -o rv32_gen : in termial
+// ./rv32_gen -n 10M --seed 7 > big.s
+//
+// Mnemonics come from the ISA table, so new instructions of a format join
+// the mix by themselves. Every branch and jump names a label within its
+// format's reach (and its .org section), so every output assembles cleanly.
+
+#include "rv32_isa.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace gen {
+
+using rv32::InstrType;
+using rv32::InstructionDef;
+using rv32::Operands;
+using rv32::ISA;
+
+struct Options {
+    uint64_t instructions = 1000;
+    uint64_t seed = 1;
+    double labelsPer1k = 50;           // mean label density
+    bool uniformDistance = false;      // else geometric
+    double distance = 16;              // geometric: mean; uniform: maximum (instructions)
+    unsigned backwardPercent = 50;     // branches and jumps that go back
+    unsigned mix[6] = {35, 35, 10, 12, 4, 4}; // weights by InstrType: R, I, S, B, U, J
+    uint64_t orgEvery = 0;             // instructions per .org section; 0: none
+    uint64_t orgGap = 0x1000;          // bytes left unused between sections
+};
+
+// SplitMix64: small, fast, and the same sequence everywhere.
+class Random {
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+    uint64_t next() {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+    // Multiply-shift rather than a 64-bit divide for the usual small bounds.
+    uint64_t below(uint64_t bound) { return bound <= UINT32_MAX ? ((next() >> 32) * bound) >> 32 : next() % bound; }
+    int64_t between(int64_t lo, int64_t hi) { return lo + static_cast<int64_t>(below(static_cast<uint64_t>(hi - lo + 1))); }
+    // Exponentially distributed with the given mean.
+    double exponential(double mean) { return -std::log((static_cast<double>(next() >> 11) + 0.5) * 0x1.0p-53) * mean; }
+};
+
+// Buffered stdout writer; number formatting stays off iostreams.
+class Output {
+    std::string buf;
+
+public:
+    Output() { buf.reserve(1 << 17); }
+    void flush() {
+        if (!buf.empty() && std::fwrite(buf.data(), 1, buf.size(), stdout) != buf.size())
+            throw std::runtime_error("Could not write output");
+        buf.clear();
+    }
+    Output& operator<<(std::string_view s) {
+        buf += s;
+        if (buf.size() >= (1 << 16)) flush();
+        return *this;
+    }
+    Output& operator<<(char c) {
+        buf += c;
+        return *this;
+    }
+    Output& operator<<(int64_t v) {
+        char tmp[24];
+        buf.append(tmp, static_cast<size_t>(std::to_chars(tmp, tmp + sizeof(tmp), v).ptr - tmp));
+        return *this;
+    }
+    Output& hex(uint64_t v) {
+        char tmp[24];
+        buf += "0x";
+        buf.append(tmp, static_cast<size_t>(std::to_chars(tmp, tmp + sizeof(tmp), v, 16).ptr - tmp));
+        return *this;
+    }
+};
+
+class Generator {
+    // Reach in instructions: B-type offsets span ±4 KiB, J-type ±1 MiB.
+    static constexpr int64_t kBranchReach = 1024;
+    static constexpr int64_t kJumpReach = 262144;
+
+    const Options& opt;
+    Random rng;
+    Output out;
+    std::vector<int> byType[6]; // definition indices per format
+    unsigned mixTotal = 0;
+
+    // Label k sits before instruction labels[k - firstLabel]. Positions are
+    // planned one jump reach ahead of the cursor, so forward targets are
+    // known before their labels are written.
+    std::deque<uint64_t> labels;
+    uint64_t firstLabel = 0, nextLabel = 0, plannedTo = 0;
+
+    void plan(uint64_t upTo) {
+        const double mean = 1000.0 / opt.labelsPer1k;
+        while (plannedTo < upTo) {
+            labels.push_back(plannedTo);
+            plannedTo += 1 + static_cast<uint64_t>(rng.exponential(mean - 1 > 0 ? mean - 1 : 0));
+        }
+    }
+
+    std::string_view reg(bool destination) {
+        static const char* const kNames[32] = {
+            "x0",  "x1",  "x2",  "x3",  "x4",  "x5",  "x6",  "x7",  "x8",  "x9",  "x10", "x11", "x12", "x13", "x14", "x15",
+            "x16", "x17", "x18", "x19", "x20", "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30", "x31",
+        };
+        return kNames[destination ? rng.between(1, 31) : rng.between(0, 31)]; // x0 is never written
+    }
+
+    // A label near the drawn distance that lies within `reach` and [lo, hi),
+    // or -1 when there is none.
+    int64_t pickTarget(uint64_t at, int64_t reach, uint64_t lo, uint64_t hi) {
+        double d = opt.uniformDistance ? static_cast<double>(rng.below(static_cast<uint64_t>(opt.distance) + 1))
+                                       : rng.exponential(opt.distance);
+        const int64_t dist = static_cast<int64_t>(std::min(d, static_cast<double>(reach)));
+        const bool back = rng.below(100) < opt.backwardPercent;
+        const int64_t want = std::clamp<int64_t>(static_cast<int64_t>(at) + (back ? -dist : dist), static_cast<int64_t>(lo),
+                                                 static_cast<int64_t>(hi) - 1);
+        auto it = std::lower_bound(labels.begin(), labels.end(), static_cast<uint64_t>(want));
+        int64_t best = -1;
+        uint64_t bestGap = UINT64_MAX;
+        for (auto c : {it, it == labels.begin() ? labels.end() : it - 1}) {
+            if (c == labels.end() || *c < lo || *c >= hi) continue;
+            const int64_t span = static_cast<int64_t>(*c) - static_cast<int64_t>(at);
+            if (span < -reach || span >= reach) continue;
+            const uint64_t gap = *c > static_cast<uint64_t>(want) ? *c - want : want - *c;
+            if (gap < bestGap) {
+                bestGap = gap;
+                best = static_cast<int64_t>(firstLabel + static_cast<uint64_t>(c - labels.begin()));
+            }
+        }
+        return best;
+    }
+
+    void instruction(uint64_t at, uint64_t sectionStart, uint64_t sectionEnd) {
+        unsigned roll = static_cast<unsigned>(rng.below(mixTotal));
+        int type = 0;
+        for (;; ++type) {
+            if (byType[type].empty()) continue;
+            if (roll < opt.mix[type]) break;
+            roll -= opt.mix[type];
+        }
+        int64_t label = -1;
+        if (type == static_cast<int>(InstrType::B_TYPE) || type == static_cast<int>(InstrType::J_TYPE)) {
+            label = pickTarget(at, type == static_cast<int>(InstrType::B_TYPE) ? kBranchReach : kJumpReach, sectionStart, sectionEnd);
+            if (label < 0) type = static_cast<int>(InstrType::I_TYPE); // nothing in reach
+        }
+        const auto& defs = byType[type];
+        const int index = defs[rng.below(defs.size())];
+        const InstructionDef& def = ISA::defAt(index);
+        const std::string_view name = ISA::nameAt(index);
+        out << "    " << name << std::string_view("      ", 6 - std::min<size_t>(name.size(), 5));
+        switch (def.operands) {
+        case Operands::RdRs1Rs2:
+            out << reg(true) << ", " << reg(false) << ", " << reg(false);
+            break;
+        case Operands::RdRs1Imm:
+            out << reg(true) << ", " << reg(false) << ", " << rng.between(-2048, 2047);
+            break;
+        case Operands::RdRs1Shamt:
+            out << reg(true) << ", " << reg(false) << ", " << rng.between(0, 31);
+            break;
+        case Operands::RdMem:
+            out << reg(true) << ", " << rng.between(-256, 252) << '(' << reg(false) << ')';
+            break;
+        case Operands::Rs2Mem:
+            out << reg(false) << ", " << rng.between(-256, 252) << '(' << reg(false) << ')';
+            break;
+        case Operands::Rs1Rs2Label:
+            out << reg(false) << ", " << reg(false) << ", L" << label;
+            break;
+        case Operands::RdImm:
+            out << reg(true) << ", ";
+            out.hex(rng.below(1 << 20));
+            break;
+        case Operands::RdLabel:
+            out << reg(true) << ", L" << label;
+            break;
+        default: // pseudo-instruction shapes
+            break;
+        }
+        out << '\n';
+    }
+
+public:
+    explicit Generator(const Options& o) : opt(o), rng(o.seed) {
+        // PSEUDO stays out of the mix: each pseudo has its own operand shape.
+        for (int i = 0; i < ISA::defCount(); ++i)
+            if (ISA::defAt(i).type != InstrType::PSEUDO) byType[static_cast<int>(ISA::defAt(i).type)].push_back(i);
+        for (int t = 0; t < 6; ++t)
+            if (!byType[t].empty()) mixTotal += opt.mix[t];
+        if (mixTotal == 0) throw std::runtime_error("Instruction mix is empty");
+    }
+
+    void run(std::string_view commandLine) {
+        const uint64_t n = opt.instructions;
+        const uint64_t section = opt.orgEvery ? opt.orgEvery : n;
+        out << "# " << commandLine << '\n';
+        uint64_t sectionStart = 0, address = 0;
+        for (uint64_t i = 0; i < n; ++i) {
+            if (i % section == 0) {
+                sectionStart = i;
+                if (opt.orgEvery) {
+                    if (i) address += opt.orgGap;
+                    out << ".org ";
+                    out.hex(address) << '\n';
+                }
+            }
+            plan(std::min(n, i + kJumpReach + 1));
+            while (!labels.empty() && labels.front() + kJumpReach < i) {
+                labels.pop_front();
+                ++firstLabel;
+            }
+            if (nextLabel < firstLabel + labels.size() && labels[nextLabel - firstLabel] == i)
+                out << 'L' << static_cast<int64_t>(nextLabel++) << ":\n";
+            instruction(i, sectionStart, std::min(n, sectionStart + section));
+            address += 4;
+        }
+        out.flush();
+    }
+};
+
+// "10k", "5M", "2G" and plain numbers.
+uint64_t parseCount(std::string_view s) {
+    uint64_t v = 0;
+    auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), v);
+    if (ec != std::errc()) throw std::runtime_error("Bad number: " + std::string(s));
+    std::string_view unit(end, static_cast<size_t>(s.data() + s.size() - end));
+    if (unit == "k" || unit == "K") v *= 1000;
+    else if (unit == "M") v *= 1000000;
+    else if (unit == "G") v *= 1000000000;
+    else if (!unit.empty()) throw std::runtime_error("Bad number: " + std::string(s));
+    return v;
+}
+
+// "R:40,I:30,B:10": formats not named get weight 0.
+void parseMix(std::string_view s, unsigned (&mix)[6]) {
+    static const char kTypes[] = "RISBUJ";
+    std::fill(std::begin(mix), std::end(mix), 0u);
+    while (!s.empty()) {
+        const size_t comma = s.find(',');
+        std::string_view item = s.substr(0, comma);
+        s = comma == std::string_view::npos ? std::string_view() : s.substr(comma + 1);
+        const char* type = item.size() > 2 && item[1] == ':' ? std::strchr(kTypes, item[0]) : nullptr;
+        if (!type || !*type) throw std::runtime_error("Bad mix entry: " + std::string(item));
+        mix[type - kTypes] = static_cast<unsigned>(parseCount(item.substr(2)));
+    }
+}
+
+} // namespace gen
+
+int main(int argc, char** argv) {
+    gen::Options opt;
+    std::string commandLine = "rv32_gen";
+    try {
+        for (int a = 1; a < argc; ++a) {
+            const int first = a;
+            std::string_view arg(argv[a]);
+            const bool hasValue = a + 1 < argc;
+            if (arg == "-n" && hasValue) opt.instructions = gen::parseCount(argv[++a]);
+            else if (arg == "--seed" && hasValue) opt.seed = gen::parseCount(argv[++a]);
+            else if (arg == "--labels" && hasValue) opt.labelsPer1k = std::strtod(argv[++a], nullptr);
+            else if (arg == "--distance" && hasValue) {
+                std::string_view v(argv[++a]);
+                const size_t colon = v.find(':');
+                if (colon == std::string_view::npos || (v.substr(0, colon) != "geometric" && v.substr(0, colon) != "uniform"))
+                    throw std::runtime_error("Bad distance: " + std::string(v));
+                opt.uniformDistance = v.substr(0, colon) == "uniform";
+                opt.distance = static_cast<double>(gen::parseCount(v.substr(colon + 1)));
+            }
+            else if (arg == "--backward" && hasValue) opt.backwardPercent = static_cast<unsigned>(gen::parseCount(argv[++a]));
+            else if (arg == "--mix" && hasValue) gen::parseMix(argv[++a], opt.mix);
+            else if (arg == "--org-every" && hasValue) opt.orgEvery = gen::parseCount(argv[++a]);
+            else if (arg == "--org-gap" && hasValue) opt.orgGap = (gen::parseCount(argv[++a]) + 3) & ~uint64_t(3);
+            else {
+                std::cerr << "Usage: rv32_gen [-n N] [--seed S] [--labels PER_1K] [--distance geometric:MEAN|uniform:MAX]\n"
+                             "                [--backward PCT] [--mix R:35,I:35,S:10,B:12,U:4,J:4]\n"
+                             "                [--org-every N] [--org-gap BYTES]\n"
+                             "       N accepts k, M and G suffixes; the program goes to stdout.\n";
+                return 1;
+            }
+            for (int i = first; i <= a; ++i) commandLine += std::string(" ") + argv[i];
+        }
+        if (opt.labelsPer1k <= 0 || opt.labelsPer1k > 1000) throw std::runtime_error("--labels must be in (0, 1000]");
+        if (opt.backwardPercent > 100) throw std::runtime_error("--backward must be at most 100");
+        const uint64_t sections = opt.orgEvery ? (opt.instructions + opt.orgEvery - 1) / opt.orgEvery : 1;
+        if (opt.instructions * 4 + (sections - 1) * opt.orgGap > (uint64_t(1) << 32))
+            std::cerr << "[Warning] The program does not fit the 32-bit address space; it will not assemble.\n";
+        gen::Generator(opt).run(commandLine);
+    } catch (const std::exception& e) {
+        std::cerr << "[Error] " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,653 @@
+// rv32_isa.hpp
+// The RV32I instruction set as one constexpr table: mnemonic, format,
+// opcode/funct3/funct7, operand syntax and, per format, where the immediate's
+// bits go. The assembler's mnemonic lookup, encode() and decode() are all
+// derived from it at compile time, so an encoder, a decoder and a simulator
+// built on this header cannot drift apart. Header-only, standard library only.
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+namespace rv32 {
+
+using InstructionCode = uint32_t;
+
+enum class InstrType { R_TYPE, I_TYPE, S_TYPE, B_TYPE, U_TYPE, J_TYPE, PSEUDO };
+
+// Assembly syntax of an instruction's operands, which also says which
+// fields of the word they fill.
+enum class Operands : uint8_t {
+    None,        // nop
+    RdRs1Rs2,    // add  rd, rs1, rs2
+    RdRs1Imm,    // addi rd, rs1, imm
+    RdRs1Shamt,  // slli rd, rs1, shamt   (funct7 above the 5-bit shamt)
+    RdMem,       // lw   rd, off(rs1)
+    Rs2Mem,      // sw   rs2, off(rs1)
+    Rs1Rs2Label, // beq  rs1, rs2, label
+    RdImm,       // lui  rd, imm          (imm is the upper 20 bits)
+    RdLabel,     // jal  rd, label
+    RdRs1,       // mv   rd, rs1
+    RdRs2,       // neg  rd, rs           (rs is rs2)
+    Rs1,         // jr   rs
+    Rs1Label,    // beqz rs, label
+    Rs2Label,    // blez rs, label        (rs is rs2)
+    Rs2Rs1Label, // bgt  rs, rt, label    (swapped: blt rt, rs)
+    Label,       // j    label
+    RdValue,     // li   rd, imm          (any 32-bit value)
+    Rs2LabelRs1, // sw   rs, sym, rt      (rt holds the address)
+};
+
+struct InstructionDef {
+    InstrType type;
+    uint32_t opcode;
+    uint32_t funct3;
+    uint32_t funct7;
+    Operands operands;
+    // PSEUDO only. What the syntax leaves out, and the format of the word it
+    // stands for; PSEUDO again for a sequence of words (see ISA::expand).
+    int32_t impliedImm = 0;
+    InstrType encodesAs = InstrType::I_TYPE;
+    uint8_t impliedRd = 0, impliedRs1 = 0;
+};
+
+// One run of immediate bits: imm[lo + width - 1 : lo] sits at word[at + width - 1 : at].
+struct ImmField {
+    uint8_t lo, width, at;
+};
+
+// The immediate layout of a format. Immediates are sign-extended from
+// bit `signBit`; B and J offsets are even, so bit 0 has no field.
+struct ImmLayout {
+    std::array<ImmField, 4> fields;
+    uint8_t count;
+    uint8_t signBit;
+};
+
+namespace detail {
+
+constexpr char asciiLower(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c + ('a' - 'A')) : c;
+}
+
+// Case-folding FNV-1a; the seed is chosen at compile time so that every key
+// of a table lands in its own slot.
+constexpr uint32_t foldHash(std::string_view s, uint32_t seed) {
+    uint32_t h = 0x811C9DC5u ^ seed;
+    for (char c : s) h = (h ^ static_cast<uint8_t>(asciiLower(c))) * 0x01000193u;
+    return h ^ (h >> 15);
+}
+
+constexpr size_t ceilPow2(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+template <typename Value>
+struct KeyValue {
+    std::string_view key;
+    Value value;
+};
+
+// Immutable, allocation-free, case-insensitive perfect-hash map built entirely
+// at compile time. A lookup is one hash, one slot load and one key compare.
+template <typename Value, size_t N>
+class PerfectHashTable {
+    static_assert(N < 0xFF, "slot indices are stored as uint8_t");
+    static constexpr size_t Slots = ceilPow2(N * 4);
+    static constexpr uint8_t Empty = 0xFF;
+
+    KeyValue<Value> entries[N] = {};
+    uint8_t slots[Slots] = {};
+    uint32_t seed = 0;
+    size_t maxKeyLen = 0;
+
+    constexpr bool trySeed(uint32_t s) {
+        for (auto& slot : slots) slot = Empty;
+        for (size_t i = 0; i < N; ++i) {
+            uint8_t& slot = slots[foldHash(entries[i].key, s) & (Slots - 1)];
+            if (slot != Empty) return false;
+            slot = static_cast<uint8_t>(i);
+        }
+        return true;
+    }
+
+public:
+    constexpr PerfectHashTable(const KeyValue<Value> (&kv)[N]) {
+        for (size_t i = 0; i < N; ++i) {
+            entries[i] = kv[i];
+            if (kv[i].key.size() > maxKeyLen) maxKeyLen = kv[i].key.size();
+        }
+        while (!trySeed(seed)) ++seed;
+    }
+
+    // Index of `key` in the original entry list, or -1.
+    constexpr int indexOf(std::string_view key) const {
+        if (key.empty() || key.size() > maxKeyLen) return -1;
+        uint8_t slot = slots[foldHash(key, seed) & (Slots - 1)];
+        if (slot == Empty) return -1;
+        std::string_view stored = entries[slot].key;
+        if (stored.size() != key.size()) return -1;
+        for (size_t i = 0; i < key.size(); ++i)
+            if (asciiLower(key[i]) != stored[i]) return -1;
+        return slot;
+    }
+
+    constexpr const Value* find(std::string_view key) const {
+        int idx = indexOf(key);
+        return idx < 0 ? nullptr : &entries[idx].value;
+    }
+
+    constexpr const KeyValue<Value>& operator[](size_t i) const { return entries[i]; }
+    static constexpr size_t size() { return N; }
+};
+
+template <typename Value, size_t N>
+constexpr PerfectHashTable<Value, N> makePerfectHash(const KeyValue<Value> (&kv)[N]) {
+    return PerfectHashTable<Value, N>(kv);
+}
+
+} // namespace detail
+
+// What decode() reads out of a word. Fields a format does not have are 0;
+// `imm` is sign-extended (U-type: the value with its low 12 bits clear).
+struct Decoded {
+    int def = -1; // index into the ISA table, -1 if the word is not one of its instructions
+    uint8_t rd = 0, rs1 = 0, rs2 = 0;
+    int32_t imm = 0;
+};
+
+class ISA {
+    static constexpr auto defTable = detail::makePerfectHash<InstructionDef>({
+        // R-Type
+        {"add",  {InstrType::R_TYPE, 0x33, 0x0, 0x00, Operands::RdRs1Rs2}},
+        {"sub",  {InstrType::R_TYPE, 0x33, 0x0, 0x20, Operands::RdRs1Rs2}},
+        {"xor",  {InstrType::R_TYPE, 0x33, 0x4, 0x00, Operands::RdRs1Rs2}},
+        {"or",   {InstrType::R_TYPE, 0x33, 0x6, 0x00, Operands::RdRs1Rs2}},
+        {"and",  {InstrType::R_TYPE, 0x33, 0x7, 0x00, Operands::RdRs1Rs2}},
+        {"sll",  {InstrType::R_TYPE, 0x33, 0x1, 0x00, Operands::RdRs1Rs2}},
+        {"srl",  {InstrType::R_TYPE, 0x33, 0x5, 0x00, Operands::RdRs1Rs2}},
+        {"sra",  {InstrType::R_TYPE, 0x33, 0x5, 0x20, Operands::RdRs1Rs2}},
+        {"slt",  {InstrType::R_TYPE, 0x33, 0x2, 0x00, Operands::RdRs1Rs2}},
+        {"sltu", {InstrType::R_TYPE, 0x33, 0x3, 0x00, Operands::RdRs1Rs2}},
+
+        // I-Type
+        {"addi", {InstrType::I_TYPE, 0x13, 0x0, 0x00, Operands::RdRs1Imm}},
+        {"xori", {InstrType::I_TYPE, 0x13, 0x4, 0x00, Operands::RdRs1Imm}},
+        {"ori",  {InstrType::I_TYPE, 0x13, 0x6, 0x00, Operands::RdRs1Imm}},
+        {"andi", {InstrType::I_TYPE, 0x13, 0x7, 0x00, Operands::RdRs1Imm}},
+        {"slli", {InstrType::I_TYPE, 0x13, 0x1, 0x00, Operands::RdRs1Shamt}},
+        {"srli", {InstrType::I_TYPE, 0x13, 0x5, 0x00, Operands::RdRs1Shamt}},
+        {"srai", {InstrType::I_TYPE, 0x13, 0x5, 0x20, Operands::RdRs1Shamt}},
+        {"slti", {InstrType::I_TYPE, 0x13, 0x2, 0x00, Operands::RdRs1Imm}},
+        {"sltiu",{InstrType::I_TYPE, 0x13, 0x3, 0x00, Operands::RdRs1Imm}},
+        {"lb",   {InstrType::I_TYPE, 0x03, 0x0, 0x00, Operands::RdMem}},
+        {"lh",   {InstrType::I_TYPE, 0x03, 0x1, 0x00, Operands::RdMem}},
+        {"lw",   {InstrType::I_TYPE, 0x03, 0x2, 0x00, Operands::RdMem}},
+        {"lbu",  {InstrType::I_TYPE, 0x03, 0x4, 0x00, Operands::RdMem}},
+        {"lhu",  {InstrType::I_TYPE, 0x03, 0x5, 0x00, Operands::RdMem}},
+        {"jalr", {InstrType::I_TYPE, 0x67, 0x0, 0x00, Operands::RdRs1Imm}},
+
+        // S-Type
+        {"sb",   {InstrType::S_TYPE, 0x23, 0x0, 0x00, Operands::Rs2Mem}},
+        {"sh",   {InstrType::S_TYPE, 0x23, 0x1, 0x00, Operands::Rs2Mem}},
+        {"sw",   {InstrType::S_TYPE, 0x23, 0x2, 0x00, Operands::Rs2Mem}},
+
+        // B-Type
+        {"beq",  {InstrType::B_TYPE, 0x63, 0x0, 0x00, Operands::Rs1Rs2Label}},
+        {"bne",  {InstrType::B_TYPE, 0x63, 0x1, 0x00, Operands::Rs1Rs2Label}},
+        {"blt",  {InstrType::B_TYPE, 0x63, 0x4, 0x00, Operands::Rs1Rs2Label}},
+        {"bge",  {InstrType::B_TYPE, 0x63, 0x5, 0x00, Operands::Rs1Rs2Label}},
+        {"bltu", {InstrType::B_TYPE, 0x63, 0x6, 0x00, Operands::Rs1Rs2Label}},
+        {"bgeu", {InstrType::B_TYPE, 0x63, 0x7, 0x00, Operands::Rs1Rs2Label}},
+
+        // U-Type
+        {"lui",  {InstrType::U_TYPE, 0x37, 0x0, 0x00, Operands::RdImm}},
+        {"auipc",{InstrType::U_TYPE, 0x17, 0x0, 0x00, Operands::RdImm}},
+
+        // J-Type
+        {"jal",  {InstrType::J_TYPE, 0x6F, 0x0, 0x00, Operands::RdLabel}},
+
+        // Pseudo-Instructions: the instruction with this opcode/funct3/funct7,
+        // in format encodesAs, with the implied immediate and registers
+        {"nop",  {InstrType::PSEUDO, 0x13, 0x0, 0x00, Operands::None, 0}},  // addi x0, x0, 0
+        {"mv",   {InstrType::PSEUDO, 0x13, 0x0, 0x00, Operands::RdRs1, 0}}, // addi rd, rs, 0
+        {"not",  {InstrType::PSEUDO, 0x13, 0x4, 0x00, Operands::RdRs1, -1}}, // xori rd, rs, -1
+        {"neg",  {InstrType::PSEUDO, 0x33, 0x0, 0x20, Operands::RdRs2, 0, InstrType::R_TYPE}}, // sub  rd, x0, rs
+        {"seqz", {InstrType::PSEUDO, 0x13, 0x3, 0x00, Operands::RdRs1, 1}},                    // sltiu rd, rs, 1
+        {"snez", {InstrType::PSEUDO, 0x33, 0x3, 0x00, Operands::RdRs2, 0, InstrType::R_TYPE}}, // sltu rd, x0, rs
+        {"sltz", {InstrType::PSEUDO, 0x33, 0x2, 0x00, Operands::RdRs1, 0, InstrType::R_TYPE}}, // slt  rd, rs, x0
+        {"sgtz", {InstrType::PSEUDO, 0x33, 0x2, 0x00, Operands::RdRs2, 0, InstrType::R_TYPE}}, // slt  rd, x0, rs
+        {"beqz", {InstrType::PSEUDO, 0x63, 0x0, 0x00, Operands::Rs1Label, 0, InstrType::B_TYPE}},    // beq  rs, x0, label
+        {"bnez", {InstrType::PSEUDO, 0x63, 0x1, 0x00, Operands::Rs1Label, 0, InstrType::B_TYPE}},    // bne  rs, x0, label
+        {"blez", {InstrType::PSEUDO, 0x63, 0x5, 0x00, Operands::Rs2Label, 0, InstrType::B_TYPE}},    // bge  x0, rs, label
+        {"bgez", {InstrType::PSEUDO, 0x63, 0x5, 0x00, Operands::Rs1Label, 0, InstrType::B_TYPE}},    // bge  rs, x0, label
+        {"bltz", {InstrType::PSEUDO, 0x63, 0x4, 0x00, Operands::Rs1Label, 0, InstrType::B_TYPE}},    // blt  rs, x0, label
+        {"bgtz", {InstrType::PSEUDO, 0x63, 0x4, 0x00, Operands::Rs2Label, 0, InstrType::B_TYPE}},    // blt  x0, rs, label
+        {"bgt",  {InstrType::PSEUDO, 0x63, 0x4, 0x00, Operands::Rs2Rs1Label, 0, InstrType::B_TYPE}}, // blt  rt, rs, label
+        {"ble",  {InstrType::PSEUDO, 0x63, 0x5, 0x00, Operands::Rs2Rs1Label, 0, InstrType::B_TYPE}}, // bge  rt, rs, label
+        {"bgtu", {InstrType::PSEUDO, 0x63, 0x6, 0x00, Operands::Rs2Rs1Label, 0, InstrType::B_TYPE}}, // bltu rt, rs, label
+        {"bleu", {InstrType::PSEUDO, 0x63, 0x7, 0x00, Operands::Rs2Rs1Label, 0, InstrType::B_TYPE}}, // bgeu rt, rs, label
+        {"j",    {InstrType::PSEUDO, 0x6F, 0x0, 0x00, Operands::Label, 0, InstrType::J_TYPE}},       // jal  x0, label
+        {"jr",   {InstrType::PSEUDO, 0x67, 0x0, 0x00, Operands::Rs1, 0}},                            // jalr x0, rs, 0
+        {"ret",  {InstrType::PSEUDO, 0x67, 0x0, 0x00, Operands::None, 0, InstrType::I_TYPE, 0, 1}},  // jalr x0, ra, 0
+
+        // Sequences: the opcode/funct3 is that of the last word, after a lui or auipc
+        {"li",   {InstrType::PSEUDO, 0x13, 0x0, 0x00, Operands::RdValue, 0, InstrType::PSEUDO}},      // addi, lui, or lui + addi
+        {"la",   {InstrType::PSEUDO, 0x13, 0x0, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},      // auipc rd; addi rd, rd
+        {"lla",  {InstrType::PSEUDO, 0x13, 0x0, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},      // the same
+        {"call", {InstrType::PSEUDO, 0x67, 0x0, 0x00, Operands::Label, 0, InstrType::PSEUDO, 1, 1}},  // auipc ra; jalr ra, ra
+        {"tail", {InstrType::PSEUDO, 0x67, 0x0, 0x00, Operands::Label, 0, InstrType::PSEUDO, 0, 6}},  // auipc t1; jalr x0, t1
+
+        // Second syntaxes of a mnemonic, keyed by the mnemonic and its operands.
+        // No word lexes to these keys: the assembler switches to one where the
+        // operands stop matching the first syntax.
+        {"jal label",      {InstrType::PSEUDO, 0x6F, 0x0, 0x00, Operands::Label, 0, InstrType::J_TYPE, 1}},       // jal  ra, label
+        {"jalr rs",        {InstrType::PSEUDO, 0x67, 0x0, 0x00, Operands::Rs1, 0, InstrType::I_TYPE, 1}},         // jalr ra, rs, 0
+        {"lb rd, sym",     {InstrType::PSEUDO, 0x03, 0x0, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},        // auipc rd; lb rd, rd
+        {"lh rd, sym",     {InstrType::PSEUDO, 0x03, 0x1, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},        // auipc rd; lh rd, rd
+        {"lw rd, sym",     {InstrType::PSEUDO, 0x03, 0x2, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},        // auipc rd; lw rd, rd
+        {"lbu rd, sym",    {InstrType::PSEUDO, 0x03, 0x4, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},        // auipc rd; lbu rd, rd
+        {"lhu rd, sym",    {InstrType::PSEUDO, 0x03, 0x5, 0x00, Operands::RdLabel, 0, InstrType::PSEUDO}},        // auipc rd; lhu rd, rd
+        {"sb rs, sym, rt", {InstrType::PSEUDO, 0x23, 0x0, 0x00, Operands::Rs2LabelRs1, 0, InstrType::PSEUDO}},    // auipc rt; sb rs, rt
+        {"sh rs, sym, rt", {InstrType::PSEUDO, 0x23, 0x1, 0x00, Operands::Rs2LabelRs1, 0, InstrType::PSEUDO}},    // auipc rt; sh rs, rt
+        {"sw rs, sym, rt", {InstrType::PSEUDO, 0x23, 0x2, 0x00, Operands::Rs2LabelRs1, 0, InstrType::PSEUDO}},    // auipc rt; sw rs, rt
+    });
+
+    static constexpr auto regTable = detail::makePerfectHash<uint8_t>({
+        {"x0", 0}, {"zero", 0}, {"x1", 1}, {"ra", 1}, {"x2", 2}, {"sp", 2},
+        {"x3", 3}, {"gp", 3},   {"x4", 4}, {"tp", 4}, {"x5", 5}, {"t0", 5},
+        {"x6", 6}, {"t1", 6},   {"x7", 7}, {"t2", 7}, {"x8", 8}, {"s0", 8}, {"fp", 8},
+        {"x9", 9}, {"s1", 9}, {"x10", 10}, {"a0", 10}, {"x11", 11}, {"a1", 11},
+        {"x12", 12}, {"a2", 12}, {"x13", 13}, {"a3", 13}, {"x14", 14}, {"a4", 14},
+        {"x15", 15}, {"a5", 15}, {"x16", 16}, {"a6", 16}, {"x17", 17}, {"a7", 17},
+        {"x18", 18}, {"s2", 18}, {"x19", 19}, {"s3", 19}, {"x20", 20}, {"s4", 20},
+        {"x21", 21}, {"s5", 21}, {"x22", 22}, {"s6", 22}, {"x23", 23}, {"s7", 23},
+        {"x24", 24}, {"s8", 24}, {"x25", 25}, {"s9", 25}, {"x26", 26}, {"s10", 26},
+        {"x27", 27}, {"s11", 27}, {"x28", 28}, {"t3", 28}, {"x29", 29}, {"t4", 29},
+        {"x30", 30}, {"t5", 30}, {"x31", 31}, {"t6", 31}
+    });
+
+    // Immediate layouts by InstrType. PSEUDO ones encode as I-type.
+    static constexpr ImmLayout kLayouts[] = {
+        {{}, 0, 0},                                                 // R
+        {{{{0, 12, 20}}}, 1, 11},                                   // I: imm[11:0]
+        {{{{0, 5, 7}, {5, 7, 25}}}, 2, 11},                         // S: imm[4:0], imm[11:5]
+        {{{{11, 1, 7}, {1, 4, 8}, {5, 6, 25}, {12, 1, 31}}}, 4, 12},  // B: imm[11], imm[4:1], imm[10:5], imm[12]
+        {{{{12, 20, 12}}}, 1, 31},                                  // U: imm[31:12]
+        {{{{12, 8, 12}, {11, 1, 20}, {1, 10, 21}, {20, 1, 31}}}, 4, 20}, // J: imm[19:12], imm[11], imm[10:1], imm[20]
+        {{{{0, 12, 20}}}, 1, 11},                                   // PSEUDO: as I
+    };
+
+    // Moves every field of Type's layout from immediate to word position
+    // (Scatter) or back. Expanded as a fold rather than a loop so that each
+    // format is straight-line code, which keeps encodeMany vectorizable.
+    template <InstrType Type, bool Scatter, size_t... I>
+    static constexpr uint32_t moveFields(uint32_t v, std::index_sequence<I...>) {
+        constexpr ImmLayout l = kLayouts[static_cast<int>(Type)];
+        return (0u | ... | (I < l.count ? ((v >> (Scatter ? l.fields[I].lo : l.fields[I].at)) & ((1u << l.fields[I].width) - 1u))
+                                              << (Scatter ? l.fields[I].at : l.fields[I].lo)
+                                        : 0u));
+    }
+
+public:
+    static constexpr std::optional<InstructionDef> getDef(std::string_view mnemonic_sv) {
+        if (const InstructionDef* def = defTable.find(mnemonic_sv)) return *def;
+        return std::nullopt;
+    }
+
+    static constexpr std::optional<uint8_t> getRegister(std::string_view reg_sv) {
+        if (const uint8_t* reg = regTable.find(reg_sv)) return *reg;
+        return std::nullopt;
+    }
+
+    // Stable index of a mnemonic in the definition table, or -1. Tokens carry
+    // this index so the encoder never has to look the text up again.
+    static constexpr int getDefIndex(std::string_view mnemonic_sv) { return defTable.indexOf(mnemonic_sv); }
+    static constexpr const InstructionDef& defAt(int index) { return defTable[static_cast<size_t>(index)].value; }
+    static constexpr std::string_view nameAt(int index) { return defTable[static_cast<size_t>(index)].key; }
+    static constexpr int defCount() { return static_cast<int>(defTable.size()); }
+
+    static constexpr const ImmLayout& immLayout(InstrType type) { return kLayouts[static_cast<int>(type)]; }
+
+    // The bits of a word that hold the immediate of format `type`.
+    static constexpr uint32_t immMask(InstrType type) {
+        uint32_t m = 0;
+        const ImmLayout& l = immLayout(type);
+        for (size_t i = 0; i < l.count; ++i) m |= ((1u << l.fields[i].width) - 1u) << l.fields[i].at;
+        return m;
+    }
+
+    // Scatters `imm` into the immediate fields of format `type`. Bits outside
+    // the fields are dropped; range checks are the caller's.
+    template <InstrType Type>
+    static constexpr uint32_t scatterImm(int32_t imm) {
+        return moveFields<Type, true>(static_cast<uint32_t>(imm), std::make_index_sequence<4>());
+    }
+    static constexpr uint32_t scatterImm(InstrType type, int32_t imm) {
+        switch (type) {
+        case InstrType::I_TYPE: return scatterImm<InstrType::I_TYPE>(imm);
+        case InstrType::S_TYPE: return scatterImm<InstrType::S_TYPE>(imm);
+        case InstrType::B_TYPE: return scatterImm<InstrType::B_TYPE>(imm);
+        case InstrType::U_TYPE: return scatterImm<InstrType::U_TYPE>(imm);
+        case InstrType::J_TYPE: return scatterImm<InstrType::J_TYPE>(imm);
+        case InstrType::PSEUDO: return scatterImm<InstrType::PSEUDO>(imm);
+        case InstrType::R_TYPE: break;
+        }
+        return 0;
+    }
+
+    // The inverse: the sign-extended immediate of a word of format `Type`.
+    template <InstrType Type>
+    static constexpr int32_t gatherImm(InstructionCode word) {
+        constexpr ImmLayout l = kLayouts[static_cast<int>(Type)];
+        uint32_t v = moveFields<Type, false>(word, std::make_index_sequence<4>());
+        if constexpr (l.signBit < 31) {
+            const uint32_t sign = 1u << l.signBit;
+            v = (v ^ sign) - sign;
+        }
+        return static_cast<int32_t>(v);
+    }
+
+    // Format encoders. The field layout is a template argument, so each one
+    // folds to a fixed set of shifts and masks with no branch on the format.
+    // Operands the format does not have are ignored, and a shift takes imm as
+    // the shift amount. A PSEUDO encodes in its encodesAs format with its
+    // implied immediate, except that branch and jump aliases take imm as the
+    // offset; a sequence has no one-word encoding (0), see expand().
+    template <InstrType Type>
+    static constexpr InstructionCode encode(const InstructionDef& d, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm) {
+        if constexpr (Type == InstrType::PSEUDO) {
+            const bool offset = d.encodesAs == InstrType::B_TYPE || d.encodesAs == InstrType::J_TYPE;
+            return d.encodesAs == InstrType::PSEUDO ? 0 : encode(d.encodesAs, d, rd, rs1, rs2, offset ? imm : d.impliedImm);
+        }
+        const InstructionCode base = d.opcode | (d.funct3 << 12);
+        rd = (rd & 31) << 7;
+        rs1 = (rs1 & 31) << 15;
+        rs2 = (rs2 & 31) << 20;
+        if constexpr (Type == InstrType::R_TYPE) {
+            return base | rd | rs1 | rs2 | (d.funct7 << 25);
+        } else if constexpr (Type == InstrType::I_TYPE) {
+            // funct7 is 0 except for srai, whose shamt is 5 bits under it
+            const uint32_t bits = d.operands == Operands::RdRs1Shamt ? 31u : 0xFFFu;
+            return base | rd | rs1 | scatterImm<Type>(static_cast<int32_t>(static_cast<uint32_t>(imm) & bits)) | (d.funct7 << 25);
+        } else if constexpr (Type == InstrType::S_TYPE || Type == InstrType::B_TYPE) {
+            return base | rs1 | rs2 | scatterImm<Type>(imm);
+        } else if constexpr (Type == InstrType::U_TYPE || Type == InstrType::J_TYPE) {
+            return d.opcode | rd | scatterImm<Type>(imm);
+        } else {
+            return 0; // PSEUDO, handled above
+        }
+    }
+
+    // Encodes `d` in format `type`: one dispatch into the encoders above.
+    static constexpr InstructionCode encode(InstrType type, const InstructionDef& d, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm) {
+        switch (type) {
+        case InstrType::R_TYPE: return encode<InstrType::R_TYPE>(d, rd, rs1, rs2, imm);
+        case InstrType::I_TYPE: return encode<InstrType::I_TYPE>(d, rd, rs1, rs2, imm);
+        case InstrType::S_TYPE: return encode<InstrType::S_TYPE>(d, rd, rs1, rs2, imm);
+        case InstrType::B_TYPE: return encode<InstrType::B_TYPE>(d, rd, rs1, rs2, imm);
+        case InstrType::U_TYPE: return encode<InstrType::U_TYPE>(d, rd, rs1, rs2, imm);
+        case InstrType::J_TYPE: return encode<InstrType::J_TYPE>(d, rd, rs1, rs2, imm);
+        case InstrType::PSEUDO: return encode<InstrType::PSEUDO>(d, rd, rs1, rs2, imm);
+        }
+        return 0;
+    }
+
+    // Encodes definition `index` from operand values.
+    static constexpr InstructionCode encode(int index, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm) {
+        const InstructionDef& d = defAt(index);
+        return encode(d.type, d, rd, rs1, rs2, imm);
+    }
+
+    // --- Pseudo-instruction sequences ---
+    static constexpr int kMaxWords = 2; // longest expansion
+
+    static constexpr bool isSequence(const InstructionDef& d) {
+        return d.type == InstrType::PSEUDO && d.encodesAs == InstrType::PSEUDO;
+    }
+
+    // The format of the word definition `index` encodes as; PSEUDO for a sequence.
+    static constexpr InstrType format(int index) {
+        const InstructionDef& d = defAt(index);
+        return d.type == InstrType::PSEUDO ? d.encodesAs : d.type;
+    }
+
+    // The halves of a 32-bit value for a lui/auipc and a 12-bit signed add:
+    // loPart sign-extends the low 12 bits, hiPart (low 12 bits clear) takes
+    // the borrow that leaves, so hiPart(v) + loPart(v) == v.
+    static constexpr int32_t loPart(int32_t v) { return static_cast<int32_t>(static_cast<uint32_t>(v) << 20) >> 20; }
+    static constexpr int32_t hiPart(int32_t v) {
+        return static_cast<int32_t>((static_cast<uint32_t>(v) + 0x800u) & 0xFFFFF000u);
+    }
+
+    // Words definition `index` assembles to. Only li's count depends on its
+    // operand, `value`: one addi if it fits 12 bits, one lui if its low 12
+    // bits are clear, else lui + addi. The other sequences take two.
+    static constexpr int length(int index, int32_t value) {
+        const InstructionDef& d = defAt(index);
+        if (!isSequence(d)) return 1;
+        if (d.operands != Operands::RdValue) return 2;
+        return loPart(value) == value || loPart(value) == 0 ? 1 : 2;
+    }
+
+    // Encodes definition `index` into out[0, length(index, imm)) and returns
+    // the count. A sequence reads rd and imm: li's value, or for the others
+    // the label's offset from the first word. Those put the upper half in an
+    // auipc to rs1 (la and loads: rd; call: ra; tail: t1; stores: rt) and the
+    // lower half in the last word, which a store also reads rs2 for.
+    static constexpr int expand(int index, uint32_t rd, uint32_t rs1, uint32_t rs2, int32_t imm, InstructionCode* out) {
+        const InstructionDef& d = defAt(index);
+        if (!isSequence(d)) {
+            out[0] = encode(d.type, d, rd, rs1, rs2, imm);
+            return 1;
+        }
+        constexpr int lui = getDefIndex("lui"), auipc = getDefIndex("auipc");
+        if (d.operands == Operands::RdValue) {
+            if (loPart(imm) == imm) {
+                out[0] = encode<InstrType::I_TYPE>(d, rd, 0, 0, imm);
+                return 1;
+            }
+            out[0] = encode<InstrType::U_TYPE>(defAt(lui), rd, 0, 0, hiPart(imm));
+            if (loPart(imm) == 0) return 1;
+            out[1] = encode<InstrType::I_TYPE>(d, rd, rd, 0, loPart(imm));
+            return 2;
+        }
+        out[0] = encode<InstrType::U_TYPE>(defAt(auipc), rs1, 0, 0, hiPart(imm));
+        out[1] = d.operands == Operands::Rs2LabelRs1 ? encode<InstrType::S_TYPE>(d, 0, rs1, rs2, loPart(imm))
+                                                     : encode<InstrType::I_TYPE>(d, rd, rs1, 0, loPart(imm));
+        return 2;
+    }
+
+    // Whether a PC-relative offset fits the field `type` stores it in: 13
+    // bits signed for B, 21 for J. An auipc pair (U_TYPE) reaches anywhere.
+    static constexpr bool reaches(InstrType type, int32_t offset) {
+        switch (type) {
+        case InstrType::B_TYPE: return offset >= -(1 << 12) && offset < (1 << 12);
+        case InstrType::J_TYPE: return offset >= -(1 << 20) && offset < (1 << 20);
+        default:                return true;
+        }
+    }
+
+    // Rewrites the PC-relative offset of encoded words once the target is
+    // known: one B/J-type word, or (U_TYPE) an auipc and the I- or S-type
+    // word after it, as the sequences with a label expand.
+    static constexpr void retarget(InstructionCode* words, InstrType type, int32_t offset) {
+        if (type == InstrType::U_TYPE) {
+            const InstrType low = (words[1] & 0x7F) == defAt(getDefIndex("sw")).opcode ? InstrType::S_TYPE : InstrType::I_TYPE;
+            words[0] = (words[0] & ~immMask(InstrType::U_TYPE)) | scatterImm<InstrType::U_TYPE>(hiPart(offset));
+            words[1] = (words[1] & ~immMask(low)) | scatterImm(low, loPart(offset));
+        } else {
+            words[0] = (words[0] & ~immMask(type)) | scatterImm(type, offset);
+        }
+    }
+
+    // Pre-parsed operands of a batch, one array per field. Only the arrays
+    // the format reads need to be set (R: rd rs1 rs2; I: rd rs1 imm;
+    // S/B: rs1 rs2 imm; U/J: rd imm; PSEUDO: those of its encodesAs
+    // format); the rest may be null. Sequences are not batched.
+    struct OperandArrays {
+        const uint8_t* rd = nullptr;
+        const uint8_t* rs1 = nullptr;
+        const uint8_t* rs2 = nullptr;
+        const int32_t* imm = nullptr;
+    };
+
+    // Encodes n instructions of definition `d`, which must be of format
+    // `Type`. The loop body is the straight-line format encoder, so the
+    // compiler vectorizes it; out must not overlap the operand arrays.
+    template <InstrType Type>
+    static void encodeMany(const InstructionDef& d, const OperandArrays& ops, InstructionCode* __restrict out, size_t n) {
+        constexpr bool hasRd = Type != InstrType::S_TYPE && Type != InstrType::B_TYPE;
+        constexpr bool hasRs1 = Type != InstrType::U_TYPE && Type != InstrType::J_TYPE;
+        constexpr bool hasRs2 = Type == InstrType::R_TYPE || Type == InstrType::S_TYPE || Type == InstrType::B_TYPE;
+        constexpr bool hasImm = Type != InstrType::R_TYPE;
+        if constexpr (Type == InstrType::PSEUDO) { // rare: no need for straight-line code
+            for (size_t i = 0; i < n; ++i)
+                out[i] = encode<Type>(d, ops.rd ? ops.rd[i] : 0, ops.rs1 ? ops.rs1[i] : 0, ops.rs2 ? ops.rs2[i] : 0, ops.imm ? ops.imm[i] : 0);
+            return;
+        }
+        const uint8_t* __restrict rd = ops.rd;
+        const uint8_t* __restrict rs1 = ops.rs1;
+        const uint8_t* __restrict rs2 = ops.rs2;
+        const int32_t* __restrict imm = ops.imm;
+        const InstructionDef def = d; // a copy: stores to out cannot change it
+        auto one = [&](size_t i) {
+            out[i] = encode<Type>(def, hasRd ? rd[i] : 0, hasRs1 ? rs1[i] : 0, hasRs2 ? rs2[i] : 0, hasImm ? imm[i] : 0);
+        };
+        // Fixed-size blocks: -O2's cost model only vectorizes loops with a
+        // known trip count.
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16)
+            for (size_t k = 0; k < 16; ++k) one(i + k);
+        for (; i < n; ++i) one(i);
+    }
+
+    // encodeMany for definition `index`: one dispatch on its format per batch.
+    static void encodeMany(int index, const OperandArrays& ops, InstructionCode* out, size_t n) {
+        const InstructionDef& d = defAt(index);
+        switch (d.type) {
+        case InstrType::R_TYPE: return encodeMany<InstrType::R_TYPE>(d, ops, out, n);
+        case InstrType::I_TYPE: return encodeMany<InstrType::I_TYPE>(d, ops, out, n);
+        case InstrType::S_TYPE: return encodeMany<InstrType::S_TYPE>(d, ops, out, n);
+        case InstrType::B_TYPE: return encodeMany<InstrType::B_TYPE>(d, ops, out, n);
+        case InstrType::U_TYPE: return encodeMany<InstrType::U_TYPE>(d, ops, out, n);
+        case InstrType::J_TYPE: return encodeMany<InstrType::J_TYPE>(d, ops, out, n);
+        case InstrType::PSEUDO: return encodeMany<InstrType::PSEUDO>(d, ops, out, n);
+        }
+    }
+
+    // Index of the instruction `word` encodes, or -1. One table load and a
+    // funct7 compare; pseudo-instructions decode as what they stand for.
+    static constexpr int decodeIndex(InstructionCode word);
+    static constexpr Decoded decode(InstructionCode word);
+
+    // Hash of every definition: changes whenever the table does, so anything
+    // keyed on what this assembler produces (the image cache) goes stale with it.
+    static constexpr uint32_t fingerprint() {
+        uint32_t h = 0x811C9DC5u;
+        for (size_t i = 0; i < defTable.size(); ++i) {
+            const auto& kv = defTable[i];
+            h = detail::foldHash(kv.key, h);
+            for (uint32_t v : {static_cast<uint32_t>(kv.value.type), kv.value.opcode, kv.value.funct3, kv.value.funct7,
+                               static_cast<uint32_t>(kv.value.operands), static_cast<uint32_t>(kv.value.impliedImm),
+                               static_cast<uint32_t>(kv.value.encodesAs), uint32_t(kv.value.impliedRd), uint32_t(kv.value.impliedRs1)})
+                h = (h ^ v) * 0x01000193u;
+        }
+        return h;
+    }
+};
+
+namespace detail {
+
+// Decode slots, one per major opcode (bits 6:2) and funct3. Where funct7
+// tells instructions apart (R-type, shifts), `alt` is the funct7 0x20 one.
+struct DecodeSlot {
+    int8_t index = -1, alt = -1;
+    bool byFunct7 = false;
+};
+
+constexpr std::array<DecodeSlot, 256> makeDecodeTable() {
+    std::array<DecodeSlot, 256> t = {};
+    for (int i = 0; i < ISA::defCount(); ++i) {
+        const InstructionDef& d = ISA::defAt(i);
+        if (d.type == InstrType::PSEUDO) continue; // aliases of real encodings
+        const bool anyFunct3 = d.type == InstrType::U_TYPE || d.type == InstrType::J_TYPE; // funct3 is immediate there
+        for (uint32_t f3 = 0; f3 < 8; ++f3) {
+            if (!anyFunct3 && f3 != d.funct3) continue;
+            DecodeSlot& s = t[((d.opcode >> 2) & 31) << 3 | f3];
+            s.byFunct7 = d.type == InstrType::R_TYPE || d.operands == Operands::RdRs1Shamt;
+            (d.funct7 == 0x20 ? s.alt : s.index) = static_cast<int8_t>(i);
+        }
+    }
+    return t;
+}
+
+inline constexpr auto kDecodeTable = makeDecodeTable();
+
+} // namespace detail
+
+constexpr int ISA::decodeIndex(InstructionCode word) {
+    const detail::DecodeSlot s = detail::kDecodeTable[((word >> 2) & 31) << 3 | ((word >> 12) & 7)];
+    if ((word & 3) != 3) return -1;
+    if (!s.byFunct7) return s.index;
+    const uint32_t funct7 = word >> 25;
+    return funct7 == 0 ? s.index : funct7 == 0x20 ? s.alt : -1;
+}
+
+constexpr Decoded ISA::decode(InstructionCode word) {
+    Decoded out;
+    out.def = decodeIndex(word);
+    if (out.def < 0) return out;
+    const InstructionDef& d = defAt(out.def);
+    const uint8_t rd = (word >> 7) & 31, rs1 = (word >> 15) & 31, rs2 = (word >> 20) & 31;
+    switch (d.type) {
+    case InstrType::R_TYPE: out.rd = rd, out.rs1 = rs1, out.rs2 = rs2; break;
+    case InstrType::I_TYPE:
+        out.rd = rd, out.rs1 = rs1;
+        out.imm = d.operands == Operands::RdRs1Shamt ? static_cast<int32_t>(rs2) : gatherImm<InstrType::I_TYPE>(word);
+        break;
+    case InstrType::S_TYPE: out.rs1 = rs1, out.rs2 = rs2, out.imm = gatherImm<InstrType::S_TYPE>(word); break;
+    case InstrType::B_TYPE: out.rs1 = rs1, out.rs2 = rs2, out.imm = gatherImm<InstrType::B_TYPE>(word); break;
+    case InstrType::U_TYPE: out.rd = rd, out.imm = gatherImm<InstrType::U_TYPE>(word); break;
+    case InstrType::J_TYPE: out.rd = rd, out.imm = gatherImm<InstrType::J_TYPE>(word); break;
+    case InstrType::PSEUDO: break;
+    }
+    return out;
+}
+
+// The tables are checked where they are built.
+static_assert(ISA::scatterImm<InstrType::B_TYPE>(-2) == 0xFE000F80u, "B-type bit scatter");
+static_assert(ISA::gatherImm<InstrType::J_TYPE>(ISA::scatterImm<InstrType::J_TYPE>(-1048576)) == -1048576, "J-type round trip");
+static_assert(ISA::decodeIndex(0x00000013) == ISA::getDefIndex("addi"), "nop decodes as addi");
+static_assert(ISA::decodeIndex(ISA::encode(ISA::getDefIndex("srai"), 1, 2, 0, 3)) == ISA::getDefIndex("srai"), "shifts keep funct7");
+// Reference words from llvm-mc: branch offsets across every B field, and srai's funct7.
+static_assert(ISA::encode(ISA::getDefIndex("beq"), 0, 1, 2, 8) == 0x00208463u, "beq x1, x2, 8");
+static_assert(ISA::encode(ISA::getDefIndex("beq"), 0, 1, 2, -4) == 0xFE208EE3u, "beq x1, x2, -4");
+static_assert(ISA::encode(ISA::getDefIndex("bne"), 0, 3, 4, 2046) == 0x7E419F63u, "bne x3, x4, 2046");
+static_assert(ISA::encode(ISA::getDefIndex("blt"), 0, 5, 6, -2048) == 0x8062C0E3u, "blt x5, x6, -2048");
+static_assert(ISA::encode(ISA::getDefIndex("srai"), 1, 2, 0, 3) == 0x40315093u, "srai x1, x2, 3");
+static_assert(ISA::encode(ISA::getDefIndex("srai"), 7, 8, 0, 31) == 0x41F45393u, "srai x7, x8, 31");
+// The second syntaxes, against llvm-mc: jal foo, jalr a0, and lw/sw through a symbol.
+static_assert(ISA::encode(ISA::getDefIndex("jal label"), ISA::defAt(ISA::getDefIndex("jal label")).impliedRd, 0, 0, 0x30) == 0x030000EFu, "jal 0x30");
+static_assert(ISA::encode(ISA::getDefIndex("jalr rs"), ISA::defAt(ISA::getDefIndex("jalr rs")).impliedRd, 10, 0, 0) == 0x000500E7u, "jalr a0");
+static_assert([] {
+    InstructionCode w[ISA::kMaxWords] = {};
+    ISA::expand(ISA::getDefIndex("lw rd, sym"), 10, 10, 0, 0, w);
+    ISA::retarget(w, InstrType::U_TYPE, 36);
+    const bool load = w[0] == 0x00000517u && w[1] == 0x02452503u;
+    ISA::expand(ISA::getDefIndex("sb rs, sym, rt"), 0, 31, 18, 0, w);
+    ISA::retarget(w, InstrType::U_TYPE, -36);
+    return load && w[0] == 0x00000F97u && w[1] == 0xFD2F8E23u;
+}(), "lw a0, sym; sb s2, sym, t6");
+static_assert(ISA::hiPart(0x12345FFF) + ISA::loPart(0x12345FFF) == 0x12345FFF && ISA::hiPart(0x12345FFF) == 0x12346000, "hi/lo carry");
+static_assert(ISA::length(ISA::getDefIndex("li"), -2048) == 1 && ISA::length(ISA::getDefIndex("li"), 0x7FFFF000) == 1 &&
+              ISA::length(ISA::getDefIndex("li"), 2048) == 2, "li picks the shortest sequence");
+
+} // namespace rv32
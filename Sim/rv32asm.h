@@ -0,0 +1,105 @@
+/* rv32asm.h
+ * Stable C ABI for embedding the assembler in testbenches, simulators and
+ * scripting languages (Python ctypes, etc.) without going through a process.
+ *
+ *   g++ -std=c++17 -O2 -fPIC -pthread -c rv32asm_capi.cpp && ar rcs librv32asm.a rv32asm_capi.o
+ *   g++ -std=c++17 -O2 -fPIC -pthread -shared rv32asm_capi.cpp -o librv32asm.so
+ *
+ * Memory: the library never hands out memory for the caller to free. Words,
+ * segments, symbols and diagnostics are written into arrays the caller owns;
+ * each count in rv32asm_result is the full count, so a call with too-small
+ * (or NULL, capacity 0) arrays returns RV32ASM_TRUNCATED and the sizes to
+ * retry with. The context keeps its working buffers between calls, so a warm
+ * context assembles an error-free source without allocating.
+ *
+ * Lifetimes: symbol names point into the caller's source buffer. Diagnostic
+ * messages point into the context and stay valid until its next assemble or
+ * destroy call.
+ *
+ * Threads: one context per thread; distinct contexts are independent.
+ */
+#ifndef RV32ASM_H
+#define RV32ASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RV32ASM_ABI_VERSION 1
+
+#if defined(_WIN32)
+#define RV32ASM_API __declspec(dllexport)
+#elif defined(__GNUC__)
+#define RV32ASM_API __attribute__((visibility("default")))
+#else
+#define RV32ASM_API
+#endif
+
+typedef enum rv32asm_status {
+    RV32ASM_OK = 0,           /* assembled; every output array held its results */
+    RV32ASM_ERRORS = 1,       /* source has errors: see the diagnostics */
+    RV32ASM_TRUNCATED = 2,    /* assembled, but an output array was too small */
+    RV32ASM_BAD_ARGUMENT = 3, /* NULL context/result, or NULL array with nonzero capacity */
+    RV32ASM_INTERNAL = 4      /* out of memory or another unexpected failure */
+} rv32asm_status;
+
+/* A placed run of words: words[first .. first+count) load at byte address base. */
+typedef struct rv32asm_segment {
+    uint32_t base;
+    uint32_t first;
+    uint32_t count;
+} rv32asm_segment;
+
+typedef struct rv32asm_symbol {
+    const char* name; /* not NUL-terminated */
+    uint32_t name_len;
+    uint32_t address;
+} rv32asm_symbol;
+
+typedef struct rv32asm_diagnostic {
+    uint32_t line;       /* 1-based; 0 when the error has no single line */
+    uint32_t message_len;
+    const char* message; /* NUL-terminated */
+} rv32asm_diagnostic;
+
+/* Caller-owned output arrays. Any array may be NULL with capacity 0. */
+typedef struct rv32asm_output {
+    uint32_t* words;
+    size_t words_capacity;
+    rv32asm_segment* segments;
+    size_t segments_capacity;
+    rv32asm_symbol* symbols;
+    size_t symbols_capacity;
+    rv32asm_diagnostic* diagnostics;
+    size_t diagnostics_capacity;
+} rv32asm_output;
+
+typedef struct rv32asm_result {
+    size_t word_count;
+    size_t segment_count;
+    size_t symbol_count;     /* labels, in no particular order */
+    size_t diagnostic_count;
+} rv32asm_result;
+
+typedef struct rv32asm_context rv32asm_context;
+
+RV32ASM_API int rv32asm_abi_version(void);
+
+/* NULL on allocation failure. */
+RV32ASM_API rv32asm_context* rv32asm_create(void);
+RV32ASM_API void rv32asm_destroy(rv32asm_context* ctx);
+
+/* Assembles source[0 .. length). `out` may be NULL to query sizes only. On
+ * RV32ASM_ERRORS, words and segments are not written; on RV32ASM_TRUNCATED,
+ * each array holds the first `capacity` results. */
+RV32ASM_API rv32asm_status rv32asm_assemble(rv32asm_context* ctx, const char* source, size_t length,
+                                            const rv32asm_output* out, rv32asm_result* result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RV32ASM_H */
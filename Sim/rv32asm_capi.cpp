@@ -0,0 +1,108 @@
+// rv32asm_capi.cpp
+// C ABI over the assembler engine; see rv32asm.h for the contract and build lines.
+
+#include "rv32asm.h"
+#include "rv32_asm.hpp"
+
+#include <new>
+
+struct rv32asm_context {
+    rv32::Assembler assembler;
+    // A lexical error throws rather than collecting; it is reported as the
+    // single diagnostic, from this buffer, which keeps its capacity.
+    rv32::Diagnostic failure;
+    bool failed = false;
+};
+
+namespace {
+
+// Lexer messages end in "at line N"; recover N so C callers get it as a field.
+size_t lineOfMessage(const std::string& message) {
+    const size_t at = message.rfind(" at line ");
+    if (at == std::string::npos) return 0;
+    size_t line = 0;
+    const char* first = message.data() + at + 9;
+    std::from_chars(first, message.data() + message.size(), line);
+    return line;
+}
+
+bool validArray(const void* p, size_t capacity) { return p != nullptr || capacity == 0; }
+
+} // namespace
+
+extern "C" {
+
+int rv32asm_abi_version(void) { return RV32ASM_ABI_VERSION; }
+
+rv32asm_context* rv32asm_create(void) { return new (std::nothrow) rv32asm_context(); }
+
+void rv32asm_destroy(rv32asm_context* ctx) { delete ctx; }
+
+rv32asm_status rv32asm_assemble(rv32asm_context* ctx, const char* source, size_t length,
+                                const rv32asm_output* out, rv32asm_result* result) {
+    static const rv32asm_output kNoOutput = {};
+    if (!ctx || !result || (!source && length)) return RV32ASM_BAD_ARGUMENT;
+    if (!out) out = &kNoOutput;
+    if (!validArray(out->words, out->words_capacity) || !validArray(out->segments, out->segments_capacity) ||
+        !validArray(out->symbols, out->symbols_capacity) || !validArray(out->diagnostics, out->diagnostics_capacity))
+        return RV32ASM_BAD_ARGUMENT;
+    *result = {};
+
+    rv32::Assembler& as = ctx->assembler;
+    ctx->failed = false;
+    try {
+        as.assemble(std::string_view(source ? source : "", length));
+    } catch (const std::bad_alloc&) {
+        return RV32ASM_INTERNAL;
+    } catch (const std::exception& e) {
+        try {
+            ctx->failure.message.assign(e.what());
+        } catch (...) {
+            return RV32ASM_INTERNAL;
+        }
+        ctx->failure.line = lineOfMessage(ctx->failure.message);
+        ctx->failed = true;
+    }
+
+    bool truncated = false;
+    auto diagnostic = [&](const rv32::Diagnostic& d) {
+        if (result->diagnostic_count < out->diagnostics_capacity)
+            out->diagnostics[result->diagnostic_count] = {static_cast<uint32_t>(d.line),
+                                                          static_cast<uint32_t>(d.message.size()), d.message.c_str()};
+        else
+            truncated = true;
+        ++result->diagnostic_count;
+    };
+    if (ctx->failed) {
+        diagnostic(ctx->failure);
+        return RV32ASM_ERRORS;
+    }
+    for (const rv32::Diagnostic& d : as.diagnostics()) diagnostic(d);
+
+    as.forEachSymbol([&](std::string_view name, rv32::Address address) {
+        if (result->symbol_count < out->symbols_capacity)
+            out->symbols[result->symbol_count] = {name.data(), static_cast<uint32_t>(name.size()), address};
+        else
+            truncated = true;
+        ++result->symbol_count;
+    });
+    if (result->diagnostic_count) return RV32ASM_ERRORS;
+
+    // Segments index the caller's word array, which is packed in segment order.
+    as.forEachSegment([&](const rv32::ImageSegment& seg) {
+        const size_t first = result->word_count;
+        if (result->segment_count < out->segments_capacity)
+            out->segments[result->segment_count] = {seg.base, static_cast<uint32_t>(first),
+                                                    static_cast<uint32_t>(seg.count)};
+        else
+            truncated = true;
+        if (first < out->words_capacity)
+            std::copy_n(seg.words, std::min(seg.count, out->words_capacity - first), out->words + first);
+        if (first + seg.count > out->words_capacity) truncated = true;
+        ++result->segment_count;
+        result->word_count += seg.count;
+    });
+    return truncated ? RV32ASM_TRUNCATED : RV32ASM_OK;
+}
+
+} // extern "C"